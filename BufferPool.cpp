@@ -0,0 +1,285 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      BufferPool.cpp
+//
+//      Implementation of CBufferPool methods.  Every buffer carries a small
+//  header in front of it recording the bucket it belongs to and its
+//  reference count, so Release needs nothing but the pointer.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "BufferPool.h"
+#include <stdlib.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+// constants
+const size_t    c_alignment         = 64;                   // alignment of every buffer
+const size_t    c_headerBytes       = 64;                   // header in front of a buffer, keeps it aligned
+const size_t    c_hugePageBytes     = 2 * 1024 * 1024;      // buffers this big may go on huge pages
+const size_t    c_maxPooledBytes    = 512 * 1024 * 1024;    // most memory kept idle in the pool
+
+struct SBufferHeader
+{
+    size_t  bucket;         // usable size of the buffer
+    size_t  alignment;      // alignment the block was allocated with
+    atomic<int> refs;       // references held by callers of Acquire and AddRef
+};// SBufferHeader
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find the header in front of a buffer.
+//
+///////////////////////////////////////////////////////////////////////////////
+static SBufferHeader* Header(const void* pBuffer)
+{
+    return (SBufferHeader*)((unsigned char*)pBuffer - c_headerBytes);
+}// Header
+
+// pool state, all guarded by s_lock
+static mutex                            s_lock;
+static map< size_t, vector<void*> >     s_free;                 // idle buffers by bucket
+static CBufferPool::SStats              s_stats             = { 0, 0, 0, 0 };
+static bool                             s_bUseHugePages     = true;
+
+// frees the idle buffers when the program exits
+static struct SPoolCleanup
+{
+    ~SPoolCleanup() { CBufferPool::Trim(); }
+}                                       s_cleanup;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Round a request up to its bucket.  Small requests go up to a multiple
+//  of 64 bytes, larger ones to one of eight steps per power of two, so
+//  images of nearly the same size share buffers and no more than an
+//  eighth is wasted.
+//
+///////////////////////////////////////////////////////////////////////////////
+static size_t BucketSize(size_t bytes)
+{
+    size_t  step = c_alignment;
+
+    if (bytes > 4096)
+    {
+        size_t  top = 1;
+        while (top <= bytes / 2)
+            top *= 2;
+        step = top / 8 > 4096 ? top / 8 : 4096;
+    }// if
+
+    if (bytes == 0)
+        bytes = 1;
+
+    return (bytes + step - 1) / step * step;
+}// BucketSize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Allocate a new block for the given bucket and set up its header.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void* AllocateBlock(size_t bucket, bool bHuge)
+{
+    size_t  alignment = bHuge ? c_hugePageBytes : c_alignment;
+    size_t  total = bucket + c_headerBytes;
+    void*   pBlock;
+
+#ifdef _WIN32
+    pBlock = _aligned_malloc(total, alignment);
+#else
+    if (posix_memalign(&pBlock, alignment, total) != 0)
+        pBlock = NULL;
+#endif
+
+    if (!pBlock)
+        throw bad_alloc();
+
+#if defined(MADV_HUGEPAGE)
+    if (bHuge)
+        madvise(pBlock, total / c_hugePageBytes * c_hugePageBytes, MADV_HUGEPAGE);
+#endif
+
+    SBufferHeader*  pHeader = new (pBlock) SBufferHeader;
+    pHeader->bucket = bucket;
+    pHeader->alignment = alignment;
+
+    return (unsigned char*)pBlock + c_headerBytes;
+}// AllocateBlock
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free a block for good.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void FreeBlock(void* pBuffer)
+{
+    SBufferHeader*  pHeader = Header(pBuffer);
+    void*           pBlock = pHeader;
+
+    pHeader->~SBufferHeader();
+
+#ifdef _WIN32
+    _aligned_free(pBlock);
+#else
+    free(pBlock);
+#endif
+}// FreeBlock
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return a buffer of at least the given size, aligned to 64 bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* CBufferPool::Acquire(size_t bytes)
+{
+    // no system hands out half the address space, and past that rounding
+    // up to the bucket and adding the header could wrap around
+    if (bytes > (size_t)-1 / 2)
+        throw bad_alloc();
+
+    size_t  bucket = BucketSize(bytes);
+    bool    bHuge;
+
+    {
+        lock_guard<mutex>   guard(s_lock);
+
+        ++s_stats.requests;
+
+        map< size_t, vector<void*> >::iterator  it = s_free.find(bucket);
+        if (it != s_free.end() && !it->second.empty())
+        {
+            void*   pBuffer = it->second.back();
+            it->second.pop_back();
+
+            ++s_stats.hits;
+            --s_stats.pooledBuffers;
+            s_stats.pooledBytes -= bucket;
+
+            Header(pBuffer)->refs = 1;
+            return (unsigned char*)pBuffer;
+        }// if
+
+        bHuge = s_bUseHugePages && bucket >= c_hugePageBytes;
+    }
+
+    void*   pBuffer = AllocateBlock(bucket, bHuge);
+
+    Header(pBuffer)->refs = 1;
+    return (unsigned char*)pBuffer;
+}// Acquire
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give a buffer back to the pool, or free it if the pool is full.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::Release(void* pBuffer)
+{
+    if (!pBuffer || --Header(pBuffer)->refs > 0)
+        return;
+
+    size_t  bucket = Header(pBuffer)->bucket;
+
+    {
+        lock_guard<mutex>   guard(s_lock);
+
+        if (s_stats.pooledBytes + bucket <= c_maxPooledBytes)
+        {
+            s_free[bucket].push_back(pBuffer);
+            ++s_stats.pooledBuffers;
+            s_stats.pooledBytes += bucket;
+            return;
+        }// if
+    }
+
+    FreeBlock(pBuffer);
+}// Release
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add a reference to a buffer.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::AddRef(void* pBuffer)
+{
+    ++Header(pBuffer)->refs;
+}// AddRef
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return whether more than one reference to the buffer is held.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CBufferPool::IsShared(const void* pBuffer)
+{
+    return Header(pBuffer)->refs > 1;
+}// IsShared
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Free every buffer waiting in the pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::Trim()
+{
+    map< size_t, vector<void*> >    idle;
+
+    {
+        lock_guard<mutex>   guard(s_lock);
+
+        idle.swap(s_free);
+        s_stats.pooledBuffers = 0;
+        s_stats.pooledBytes = 0;
+    }
+
+    for (map< size_t, vector<void*> >::iterator it = idle.begin(); it != idle.end(); ++it)
+        for (size_t i = 0; i < it->second.size(); ++i)
+            FreeBlock(it->second[i]);
+}// Trim
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn huge pages for large buffers on or off.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CBufferPool::UseHugePages(bool bUse)
+{
+    lock_guard<mutex>   guard(s_lock);
+
+    s_bUseHugePages = bUse;
+}// UseHugePages
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return a snapshot of the pool counters.
+//
+///////////////////////////////////////////////////////////////////////////////
+CBufferPool::SStats CBufferPool::GetStats()
+{
+    lock_guard<mutex>   guard(s_lock);
+
+    return s_stats;
+}// GetStats
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      BufferPool.h
+//
+//      Pool of 64-byte aligned buffers for pixel data and per-command
+//  scratch space.  Released buffers are kept in size buckets and handed out
+//  again, so a script that runs one filter after another stops paying for
+//  fresh pages on every command.  Buffers are reference counted so images
+//  can share pixels until one of them writes.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_BUFFER_POOL
+#define _C_BUFFER_POOL
+
+#include <stddef.h>
+
+class CBufferPool
+{
+    // types
+    public:
+        struct SStats
+        {
+            size_t  requests;           // calls to Acquire
+            size_t  hits;               // requests served from the pool
+            size_t  pooledBuffers;      // buffers waiting to be reused
+            size_t  pooledBytes;        // bytes held by those buffers
+        };// SStats
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return a buffer of at least the given size, aligned to 64 bytes, holding
+        //  one reference.  The contents are undefined.  Throws std::bad_alloc if
+        //  memory runs out.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static unsigned char* Acquire(size_t bytes);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Drop a reference to a buffer from Acquire.  The buffer goes back to
+        //  the pool when the last reference is dropped.  NULL is ignored.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Release(void* pBuffer);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Add a reference to a buffer from Acquire, or ask whether it has more
+        //  than one.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void AddRef(void* pBuffer);
+        static bool IsShared(const void* pBuffer);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Free every buffer waiting in the pool.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Trim();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Ask for transparent huge pages on large buffers allocated from now on,
+        //  where the system supports it.  On by default.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void UseHugePages(bool bUse);
+
+        static SStats GetStats();
+};// CBufferPool
+
+#endif // _C_BUFFER_POOL
@@ -0,0 +1,451 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FilterKernels.cpp
+//
+//      Implementation of CFilterKernels methods.  The vector versions are
+//  compiled for their instruction sets function by function, so the rest
+//  of the program still runs on any x86 processor; they are only called
+//  once CPUID says the processor has them.  Columns and pixels left over
+//  at the end of a row go through the scalar loops.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "FilterKernels.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FILTER_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// compile one function for an instruction set the rest of the program
+// may not assume
+#if defined(__GNUC__)
+#define TARGET(isa) __attribute__((target(isa)))
+#else
+#define TARGET(isa)
+#endif
+
+typedef void (*FSumColumns)(const unsigned char* const*, const unsigned short*, int, int, unsigned short*);
+typedef void (*FSumRow)(const unsigned short*, const unsigned short*, int, int, const CFilterKernels::SDivide&,
+                        const unsigned char*, unsigned char*);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Scalar loops, used whole at the scalar level and for what is left
+//  over at the end of a row by the others.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Sum_Columns_Tail(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                             int start, int count, unsigned short* sums)
+{
+    for (int i = start; i < count; ++i)
+    {
+        unsigned int    sum = 0;
+
+        for (int k = 0; k < taps; ++k)
+            sum += rows[k][i] * weights[k];
+        sums[i] = (unsigned short)sum;
+    }// for
+}// Sum_Columns_Tail
+
+static void Sum_Row_Tail(const unsigned short* sums, const unsigned short* kernel, int taps, int start, int pixels,
+                         const CFilterKernels::SDivide& divide, const unsigned char* alpha, unsigned char* out)
+{
+    for (int p = start; p < pixels; ++p)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int    n = divide.bias;
+
+            for (int x = 0; x < taps; ++x)
+                n += kernel[x] * sums[(p + x) * 4 + k];
+            out[p * 4 + k] = (unsigned char)((n * divide.multiplier) >> (16 + divide.shift));
+        }// for
+        out[p * 4 + 3] = alpha[p * 4 + 3];
+    }// for
+}// Sum_Row_Tail
+
+static void Sum_Columns_Scalar(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                               int count, unsigned short* sums)
+{
+    Sum_Columns_Tail(rows, weights, taps, 0, count, sums);
+}// Sum_Columns_Scalar
+
+static void Sum_Row_Scalar(const unsigned short* sums, const unsigned short* kernel, int taps, int pixels,
+                           const CFilterKernels::SDivide& divide, const unsigned char* alpha, unsigned char* out)
+{
+    Sum_Row_Tail(sums, kernel, taps, 0, pixels, divide, alpha, out);
+}// Sum_Row_Scalar
+
+
+#ifdef FILTER_KERNELS_X86
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      SSE2: 16 columns, or 4 pixels, at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET("sse2")
+static void Sum_Columns_SSE2(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                             int count, unsigned short* sums)
+{
+    const __m128i   zero = _mm_setzero_si128();
+    int             i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i lo = zero;
+        __m128i hi = zero;
+
+        for (int k = 0; k < taps; ++k)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(rows[k] + i));
+            __m128i weight = _mm_set1_epi16((short)weights[k]);
+
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_unpacklo_epi8(bytes, zero), weight));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_unpackhi_epi8(bytes, zero), weight));
+        }// for
+
+        _mm_storeu_si128((__m128i*)(sums + i), lo);
+        _mm_storeu_si128((__m128i*)(sums + i + 8), hi);
+    }// for
+
+    Sum_Columns_Tail(rows, weights, taps, i, count, sums);
+}// Sum_Columns_SSE2
+
+TARGET("sse2")
+static void Sum_Row_SSE2(const unsigned short* sums, const unsigned short* kernel, int taps, int pixels,
+                         const CFilterKernels::SDivide& divide, const unsigned char* alpha, unsigned char* out)
+{
+    const __m128i   bias = _mm_set1_epi16((short)divide.bias);
+    const __m128i   multiplier = _mm_set1_epi16((short)divide.multiplier);
+    const __m128i   shift = _mm_cvtsi32_si128(divide.shift);
+    const __m128i   alphaMask = _mm_set1_epi32((int)0xFF000000);
+    int             p = 0;
+
+    for (; p + 4 <= pixels; p += 4)
+    {
+        __m128i lo = bias;
+        __m128i hi = bias;
+
+        for (int x = 0; x < taps; ++x)
+        {
+            const unsigned short    *from = sums + (p + x) * 4;
+            __m128i                 weight = _mm_set1_epi16((short)kernel[x]);
+
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)from), weight));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(from + 8)), weight));
+        }// for
+
+        lo = _mm_srl_epi16(_mm_mulhi_epu16(lo, multiplier), shift);
+        hi = _mm_srl_epi16(_mm_mulhi_epu16(hi, multiplier), shift);
+
+        __m128i colour = _mm_packus_epi16(lo, hi);
+        __m128i source = _mm_loadu_si128((const __m128i*)(alpha + p * 4));
+
+        colour = _mm_or_si128(_mm_andnot_si128(alphaMask, colour), _mm_and_si128(alphaMask, source));
+        _mm_storeu_si128((__m128i*)(out + p * 4), colour);
+    }// for
+
+    Sum_Row_Tail(sums, kernel, taps, p, pixels, divide, alpha, out);
+}// Sum_Row_SSE2
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX2: 32 columns, or 8 pixels, at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET("avx2")
+static void Sum_Columns_AVX2(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                             int count, unsigned short* sums)
+{
+    int i = 0;
+
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+
+        for (int k = 0; k < taps; ++k)
+        {
+            const unsigned char *row = rows[k] + i;
+            __m256i             weight = _mm256_set1_epi16((short)weights[k]);
+
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)row)), weight));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(row + 16))), weight));
+        }// for
+
+        _mm256_storeu_si256((__m256i*)(sums + i), lo);
+        _mm256_storeu_si256((__m256i*)(sums + i + 16), hi);
+    }// for
+
+    Sum_Columns_Tail(rows, weights, taps, i, count, sums);
+}// Sum_Columns_AVX2
+
+TARGET("avx2")
+static void Sum_Row_AVX2(const unsigned short* sums, const unsigned short* kernel, int taps, int pixels,
+                         const CFilterKernels::SDivide& divide, const unsigned char* alpha, unsigned char* out)
+{
+    const __m256i   bias = _mm256_set1_epi16((short)divide.bias);
+    const __m256i   multiplier = _mm256_set1_epi16((short)divide.multiplier);
+    const __m128i   shift = _mm_cvtsi32_si128(divide.shift);
+    const __m256i   alphaMask = _mm256_set1_epi32((int)0xFF000000);
+    int             p = 0;
+
+    for (; p + 8 <= pixels; p += 8)
+    {
+        __m256i lo = bias;
+        __m256i hi = bias;
+
+        for (int x = 0; x < taps; ++x)
+        {
+            const unsigned short    *from = sums + (p + x) * 4;
+            __m256i                 weight = _mm256_set1_epi16((short)kernel[x]);
+
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)from), weight));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(from + 16)), weight));
+        }// for
+
+        lo = _mm256_srl_epi16(_mm256_mulhi_epu16(lo, multiplier), shift);
+        hi = _mm256_srl_epi16(_mm256_mulhi_epu16(hi, multiplier), shift);
+
+        // packing works within 128-bit lanes, so put the pixels back in order
+        __m256i colour = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+        __m256i source = _mm256_loadu_si256((const __m256i*)(alpha + p * 4));
+
+        colour = _mm256_or_si256(_mm256_andnot_si256(alphaMask, colour), _mm256_and_si256(alphaMask, source));
+        _mm256_storeu_si256((__m256i*)(out + p * 4), colour);
+    }// for
+
+    Sum_Row_Tail(sums, kernel, taps, p, pixels, divide, alpha, out);
+}// Sum_Row_AVX2
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      AVX-512 with byte and word instructions: 64 columns, or 16 pixels,
+//  at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+TARGET("avx512f,avx512bw")
+static void Sum_Columns_AVX512(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                               int count, unsigned short* sums)
+{
+    int i = 0;
+
+    for (; i + 64 <= count; i += 64)
+    {
+        __m512i lo = _mm512_setzero_si512();
+        __m512i hi = _mm512_setzero_si512();
+
+        for (int k = 0; k < taps; ++k)
+        {
+            const unsigned char *row = rows[k] + i;
+            __m512i             weight = _mm512_set1_epi16((short)weights[k]);
+
+            lo = _mm512_add_epi16(lo, _mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)row)), weight));
+            hi = _mm512_add_epi16(hi, _mm512_mullo_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(row + 32))), weight));
+        }// for
+
+        _mm512_storeu_si512((void*)(sums + i), lo);
+        _mm512_storeu_si512((void*)(sums + i + 32), hi);
+    }// for
+
+    Sum_Columns_Tail(rows, weights, taps, i, count, sums);
+}// Sum_Columns_AVX512
+
+TARGET("avx512f,avx512bw")
+static void Sum_Row_AVX512(const unsigned short* sums, const unsigned short* kernel, int taps, int pixels,
+                           const CFilterKernels::SDivide& divide, const unsigned char* alpha, unsigned char* out)
+{
+    const __m512i   bias = _mm512_set1_epi16((short)divide.bias);
+    const __m512i   multiplier = _mm512_set1_epi16((short)divide.multiplier);
+    const __m128i   shift = _mm_cvtsi32_si128(divide.shift);
+    const __m512i   order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    const __mmask64 alphaMask = 0x8888888888888888ULL;
+    int             p = 0;
+
+    for (; p + 16 <= pixels; p += 16)
+    {
+        __m512i lo = bias;
+        __m512i hi = bias;
+
+        for (int x = 0; x < taps; ++x)
+        {
+            const unsigned short    *from = sums + (p + x) * 4;
+            __m512i                 weight = _mm512_set1_epi16((short)kernel[x]);
+
+            lo = _mm512_add_epi16(lo, _mm512_mullo_epi16(_mm512_loadu_si512((const void*)from), weight));
+            hi = _mm512_add_epi16(hi, _mm512_mullo_epi16(_mm512_loadu_si512((const void*)(from + 32)), weight));
+        }// for
+
+        lo = _mm512_srl_epi16(_mm512_mulhi_epu16(lo, multiplier), shift);
+        hi = _mm512_srl_epi16(_mm512_mulhi_epu16(hi, multiplier), shift);
+
+        // packing works within 128-bit lanes, so put the pixels back in order
+        __m512i colour = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(lo, hi));
+        __m512i source = _mm512_loadu_si512((const void*)(alpha + p * 4));
+
+        _mm512_storeu_si512((void*)(out + p * 4), _mm512_mask_blend_epi8(alphaMask, colour, source));
+    }// for
+
+    Sum_Row_Tail(sums, kernel, taps, p, pixels, divide, alpha, out);
+}// Sum_Row_AVX512
+
+#endif // FILTER_KERNELS_X86
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the best level the processor and operating system support.
+//
+///////////////////////////////////////////////////////////////////////////////
+static CFilterKernels::ELevel Detect()
+{
+#if defined(FILTER_KERNELS_X86) && defined(_MSC_VER)
+    int     info[4];
+    bool    bSSE2, bAVX2 = false, bAVX512 = false;
+
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    bSSE2 = (info[3] & (1 << 26)) != 0;
+
+    // the wide registers also need the operating system to save them
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && maxLeaf >= 7)
+    {
+        unsigned long long  xcr0 = _xgetbv(0);
+
+        __cpuidex(info, 7, 0);
+        bAVX2 = (xcr0 & 0x06) == 0x06 && (info[1] & (1 << 5));
+        bAVX512 = (xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16)) && (info[1] & (1 << 30));
+    }// if
+
+    if (bAVX512)
+        return CFilterKernels::AVX512;
+    if (bAVX2)
+        return CFilterKernels::AVX2;
+    if (bSSE2)
+        return CFilterKernels::SSE2;
+#elif defined(FILTER_KERNELS_X86) && defined(__GNUC__)
+    // these check that the operating system saves the wide registers too
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return CFilterKernels::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return CFilterKernels::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return CFilterKernels::SSE2;
+#endif
+
+    return CFilterKernels::SCALAR;
+}// Detect
+
+
+// the loops of each level, indexed by ELevel
+static const FSumColumns    c_sumColumns[CFilterKernels::NUM_LEVELS] = {
+#ifdef FILTER_KERNELS_X86
+    Sum_Columns_Scalar, Sum_Columns_SSE2, Sum_Columns_AVX2, Sum_Columns_AVX512
+#else
+    Sum_Columns_Scalar, Sum_Columns_Scalar, Sum_Columns_Scalar, Sum_Columns_Scalar
+#endif
+};
+static const FSumRow        c_sumRow[CFilterKernels::NUM_LEVELS] = {
+#ifdef FILTER_KERNELS_X86
+    Sum_Row_Scalar, Sum_Row_SSE2, Sum_Row_AVX2, Sum_Row_AVX512
+#else
+    Sum_Row_Scalar, Sum_Row_Scalar, Sum_Row_Scalar, Sum_Row_Scalar
+#endif
+};
+static const char*          c_asNames[CFilterKernels::NUM_LEVELS] = { "scalar", "sse2", "avx2", "avx512" };
+
+// picked when the program starts
+static const CFilterKernels::ELevel s_best          = Detect();
+static CFilterKernels::ELevel       s_level         = s_best;
+static FSumColumns                  s_pSumColumns   = c_sumColumns[s_best];
+static FSumRow                      s_pSumRow       = c_sumRow[s_best];
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Find a 16-bit multiplier that divides every n up to limit by divisor
+//  exactly.  With multiplier the divisor's reciprocal rounded up to
+//  16 + shift bits, n * multiplier overshoots n * 2^(16 + shift) / divisor
+//  by n times the rounding error over the divisor, which leaves the
+//  quotient alone while it stays under 2^(16 + shift) / divisor.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CFilterKernels::Make_Divide(unsigned int divisor, unsigned int bias, unsigned int limit, SDivide& divide)
+{
+    if (!divisor || bias > 0xFFFF || limit > 0xFFFF - bias)
+        return false;
+
+    // the longest multiplier that fits is the most precise
+    for (int shift = 15; shift >= 0; --shift)
+    {
+        unsigned long long  scale = 1ULL << (16 + shift);
+        unsigned long long  multiplier = (scale + divisor - 1) / divisor;
+
+        if (multiplier > 0xFFFF)
+            continue;
+        if ((limit + bias) * (multiplier * divisor - scale) >= scale)
+            return false;
+
+        divide.bias = (unsigned short)bias;
+        divide.multiplier = (unsigned short)multiplier;
+        divide.shift = shift;
+        return true;
+    }// for
+
+    return false;
+}// Make_Divide
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the loops of the level in use.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CFilterKernels::Sum_Columns(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                                 int count, unsigned short* sums)
+{
+    s_pSumColumns(rows, weights, taps, count, sums);
+}// Sum_Columns
+
+void CFilterKernels::Sum_Row(const unsigned short* sums, const unsigned short* kernel, int taps, int pixels,
+                             const SDivide& divide, const unsigned char* alpha, unsigned char* out)
+{
+    s_pSumRow(sums, kernel, taps, pixels, divide, alpha, out);
+}// Sum_Row
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return or switch the level in use.  Levels above the best the
+//  processor supports fall back to it.
+//
+///////////////////////////////////////////////////////////////////////////////
+CFilterKernels::ELevel CFilterKernels::GetLevel()
+{
+    return s_level;
+}// GetLevel
+
+CFilterKernels::ELevel CFilterKernels::SetLevel(ELevel level)
+{
+    s_level = level < s_best ? level : s_best;
+    s_pSumColumns = c_sumColumns[s_level];
+    s_pSumRow = c_sumRow[s_level];
+    return s_level;
+}// SetLevel
+
+const char* CFilterKernels::Name(ELevel level)
+{
+    return c_asNames[level];
+}// Name
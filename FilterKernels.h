@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      FilterKernels.h
+//
+//      Inner loops of the small separable filters in 16-bit fixed point,
+//  with SSE2, AVX2 and AVX-512 versions beside the scalar one.  The best
+//  version the processor supports is picked from CPUID when the program
+//  starts.  Every version gives the same result as the scalar one and as
+//  the filters' own wider loops, which take kernels whose sums overflow
+//  16 bits.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_FILTER_KERNELS
+#define _C_FILTER_KERNELS
+
+class CFilterKernels
+{
+    // types
+    public:
+        enum ELevel
+        {
+            SCALAR,
+            SSE2,
+            AVX2,
+            AVX512,
+            NUM_LEVELS
+        };// ELevel
+
+        // n / divisor, rounded down, for n up to a limit, computed as
+        // (n * multiplier) >> (16 + shift)
+        struct SDivide
+        {
+            unsigned short  bias;           // added to each sum before dividing
+            unsigned short  multiplier;
+            int             shift;
+        };// SDivide
+
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Find a 16-bit multiplier that divides every n up to limit by divisor
+        //  exactly.  Returns false if there is none, or if limit plus bias does
+        //  not fit in 16 bits.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool Make_Divide(unsigned int divisor, unsigned int bias, unsigned int limit, SDivide& divide);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set each of count sums to the weighted sum of the bytes at the same
+        //  place in taps rows.  The sums must fit in 16 bits.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Sum_Columns(const unsigned char* const* rows, const unsigned short* weights, int taps,
+                                int count, unsigned short* sums);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Filter pixels RGBA pixels along a row of column sums.  Colour channel
+        //  k of pixel p is the sum over x of kernel[x] * sums[(p + x) * 4 + k],
+        //  divided by divide; alpha is copied from the pixels at alpha.  The sums
+        //  plus the bias must fit in 16 bits.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Sum_Row(const unsigned short* sums, const unsigned short* kernel, int taps, int pixels,
+                            const SDivide& divide, const unsigned char* alpha, unsigned char* out);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Return the version in use, or switch to another.  A level the
+        //  processor lacks falls back to the best it has; the level used is
+        //  returned.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static ELevel GetLevel();
+        static ELevel SetLevel(ELevel level);
+
+        // name of a level as the simd script command takes it
+        static const char* Name(ELevel level);
+};// CFilterKernels
+
+#endif // _C_FILTER_KERNELS
@@ -0,0 +1,197 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ImageView.h
+//
+//      A window onto RGBA pixels owned by someone else: a pointer to the top
+//  left pixel, a size, and the number of bytes from one row to the next.
+//  Image operations loop over a view, so they run the same on a whole image
+//  or on a rectangle inside it without copying the rectangle out.
+//  PlanarView is the same window onto an image split into separate red,
+//  green, blue and alpha planes of one byte per pixel.  TiledView is an
+//  image stored as 64x64 RGBA tiles, each tile itself an ImageView, with an
+//  iterator over the tiles and halo copies for neighbourhood operations.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _IMAGE_VIEW_H_
+#define _IMAGE_VIEW_H_
+
+#include <stddef.h>
+#include <string.h>
+
+struct ImageView
+{
+    unsigned char   *data;      // top left pixel
+    int             width;      // width in pixels
+    int             height;     // height in pixels
+    int             stride;     // bytes from the start of one row to the next
+
+    ImageView() : data(NULL), width(0), height(0), stride(0)
+    {}
+
+    ImageView(unsigned char *d, int w, int h, int s) : data(d), width(w), height(h), stride(s)
+    {}
+
+    // first pixel of row y
+    unsigned char* Row(int y) const
+    {
+        return data + (ptrdiff_t)y * stride;
+    }
+
+    // the w x h rectangle with its top left corner at (x, y)
+    ImageView Sub(int x, int y, int w, int h) const
+    {
+        return ImageView(Row(y) + x * 4, w, h, stride);
+    }
+};// ImageView
+
+struct PlanarView
+{
+    unsigned char   *plane[4];  // top left pixel of each plane, indexed by channel
+    int             width;      // width in pixels
+    int             height;     // height in pixels
+    int             stride;     // bytes from the start of one row to the next in a plane
+
+    PlanarView() : width(0), height(0), stride(0)
+    {
+        plane[0] = plane[1] = plane[2] = plane[3] = NULL;
+    }
+
+    // planes stored one after another in a single buffer
+    PlanarView(unsigned char *d, int w, int h, int s) : width(w), height(h), stride(s)
+    {
+        for (int i = 0; i < 4; ++i)
+            plane[i] = d + (ptrdiff_t)i * h * s;
+    }
+
+    // first pixel of row y in the given channel
+    unsigned char* Row(int channel, int y) const
+    {
+        return plane[channel] + (ptrdiff_t)y * stride;
+    }
+
+    // the w x h rectangle with its top left corner at (x, y)
+    PlanarView Sub(int x, int y, int w, int h) const
+    {
+        PlanarView  view(*this);
+
+        for (int i = 0; i < 4; ++i)
+            view.plane[i] = Row(i, y) + x;
+        view.width = w;
+        view.height = h;
+        return view;
+    }
+};// PlanarView
+
+struct TiledView
+{
+    static const int    TILE_SIZE = 64;                             // tiles are TILE_SIZE pixels square
+    static const int    TILE_BYTES = TILE_SIZE * TILE_SIZE * 4;     // bytes in a tile, partial tiles included
+
+    unsigned char   *data;          // tiles left to right, then top to bottom
+    int             width;          // image width in pixels
+    int             height;         // image height in pixels
+    int             tilesAcross;    // tiles in a row of tiles
+    int             tilesDown;      // rows of tiles
+
+    TiledView() : data(NULL), width(0), height(0), tilesAcross(0), tilesDown(0)
+    {}
+
+    TiledView(unsigned char *d, int w, int h) : data(d), width(w), height(h),
+        tilesAcross((w + TILE_SIZE - 1) / TILE_SIZE), tilesDown((h + TILE_SIZE - 1) / TILE_SIZE)
+    {}
+
+    // bytes needed to hold an image of the given size
+    static size_t Bytes(int w, int h)
+    {
+        return (size_t)((w + TILE_SIZE - 1) / TILE_SIZE) * ((h + TILE_SIZE - 1) / TILE_SIZE) * TILE_BYTES;
+    }
+
+    // the pixel at (x, y) in the image
+    unsigned char* Pixel(int x, int y) const
+    {
+        return data + ((ptrdiff_t)(y / TILE_SIZE) * tilesAcross + x / TILE_SIZE) * TILE_BYTES
+                    + ((y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE) * 4;
+    }
+
+    // the pixels of tile (tx, ty) that lie inside the image
+    ImageView Tile(int tx, int ty) const
+    {
+        int w = width - tx * TILE_SIZE;
+        int h = height - ty * TILE_SIZE;
+
+        return ImageView(data + ((ptrdiff_t)ty * tilesAcross + tx) * TILE_BYTES,
+                         w < TILE_SIZE ? w : TILE_SIZE, h < TILE_SIZE ? h : TILE_SIZE, TILE_SIZE * 4);
+    }
+
+    // Copy tile (tx, ty) and the pixels up to radius around it into buffer,
+    // which must hold (TILE_SIZE + 2 * radius) squared pixels.  The view
+    // returned starts at the tile's top left pixel, so neighbours are read
+    // at negative offsets.  Halo pixels outside the image are left unset.
+    ImageView Halo(int tx, int ty, int radius, unsigned char *buffer) const
+    {
+        ImageView   tile = Tile(tx, ty);
+        ImageView   halo(buffer, tile.width, tile.height, (TILE_SIZE + 2 * radius) * 4);
+        int         left = tx * TILE_SIZE;
+        int         top = ty * TILE_SIZE;
+        int         x0 = left < radius ? -left : -radius;
+        int         y0 = top < radius ? -top : -radius;
+        int         x1 = width - left < tile.width + radius ? width - left : tile.width + radius;
+        int         y1 = height - top < tile.height + radius ? height - top : tile.height + radius;
+
+        halo.data += radius * halo.stride + radius * 4;
+        for (int y = y0; y < y1; ++y)
+        {
+            // a row of the halo crosses at most three tiles
+            for (int x = x0, run; x < x1; x += run)
+            {
+                run = TILE_SIZE - (left + x) % TILE_SIZE;
+                if (run > x1 - x)
+                    run = x1 - x;
+                memcpy(halo.Row(y) + x * 4, Pixel(left + x, top + y), run * 4);
+            }// for
+        }// for
+
+        return halo;
+    }
+};// TiledView
+
+struct TileIterator
+{
+    const TiledView &grid;  // tiles being visited
+    int             tx;     // current tile
+    int             ty;
+
+    TileIterator(const TiledView &g) : grid(g), tx(0), ty(g.tilesAcross ? 0 : g.tilesDown)
+    {}
+
+    bool Done() const
+    {
+        return ty >= grid.tilesDown;
+    }
+
+    void Next()
+    {
+        if (++tx == grid.tilesAcross)
+        {
+            tx = 0;
+            ++ty;
+        }
+    }
+
+    // image position of the current tile's top left pixel
+    int X() const { return tx * TiledView::TILE_SIZE; }
+    int Y() const { return ty * TiledView::TILE_SIZE; }
+
+    ImageView Tile() const
+    {
+        return grid.Tile(tx, ty);
+    }
+
+    ImageView Halo(int radius, unsigned char *buffer) const
+    {
+        return grid.Halo(tx, ty, radius, buffer);
+    }
+};// TileIterator
+
+#endif // _IMAGE_VIEW_H_
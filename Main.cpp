@@ -19,17 +19,22 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Window.h>
 #include <string.h>
+#include <stdlib.h>
 #include <iostream>
 #include <vector>
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "TileStore.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
 // constants
 const char      c_sNames[]          = "-names";             // display student names command line switch
 const char      c_sHeadless[]       = "-headless";          // headless command line switch
+const char      c_sMemBudget[]      = "-mem-budget";        // memory budget for out-of-core images switch
+const char      c_sThreads[]        = "-threads";           // threads the image operations use switch
 
 // globals
 std::vector<char*>  vsStudentNames;
@@ -99,6 +104,7 @@ int main(int argc, char *argv[])
     // check command line arguments
     TargaImage* pImage = NULL;
     bool bHeadless = false;
+    size_t budget;
 
     for (int i = script_arg; i < argc; ++i)
     {
@@ -106,11 +112,23 @@ int main(int argc, char *argv[])
             DisplayNames();
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
+        else if (!strcmp(argv[i], c_sMemBudget) && i + 1 < argc &&     // set memory budget
+                 CTileStore::ParseSize(argv[i + 1], budget))
+        {
+            CTileStore::SetBudget(budget);
+            ++i;
+        }// else if
+        else if (!strcmp(argv[i], c_sThreads) && i + 1 < argc &&        // set thread count
+                 atoi(argv[i + 1]) > 0)
+        {
+            CThreadPool::SetThreads(atoi(argv[i + 1]));
+            ++i;
+        }// else if
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
             CScriptHandler::HandleScriptFile(argv[i], pImage);
         else
         {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            cerr << "Usage:" << endl << "Project1 [-names] [-mem-budget size] [-threads N] [-headless scriptFilenames . . .]" << endl;
             return 0;
         }// else
     }// for
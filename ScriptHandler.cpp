@@ -15,6 +15,9 @@
 #include <fstream>
 #include <string.h>
 #include "TargaImage.h"
+#include "BufferPool.h"
+#include "TileStore.h"
+#include "FilterKernels.h"
 
 using namespace std;
 
@@ -22,8 +25,18 @@ using namespace std;
 const int       c_maxLineLength         = 1000;                         // maximum length of a command in a script
 const char      c_sWhiteSpace[]         = " \t\n\r"; 
 const char      c_asCommands[][32]      = { "load",                     // valid commands
+                                            "load-region",
+                                            "load-scaled",
                                             "save",
+                                            "save-rle",
+                                            "stream",
                                             "run",
+                                            "pool-stats",
+                                            "select",
+                                            "layout",
+                                            "tiles",
+                                            "mem-budget",
+                                            "simd",
                                             "gray",
                                             "quant-unif",
                                             "quant-pop",
@@ -35,9 +48,11 @@ const char      c_asCommands[][32]      = { "load",                     // valid
 					    "dither-pattern",
 					    "dither-color",
                                             "filter-box",
+                                            "filter-box-n",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
+                                            "filter-gauss-iir",
                                             "filter-edge",
                                             "filter-enhance",
                                             "npr-paint",
@@ -56,8 +71,18 @@ const char      c_asCommands[][32]      = { "load",                     // valid
 enum ECommands          // command ids
 {
     LOAD,
+    LOAD_REGION,
+    LOAD_SCALED,
     SAVE,
+    SAVE_RLE,
+    STREAM,
     RUN,
+    POOL_STATS,
+    SELECT,
+    LAYOUT,
+    TILES,
+    MEM_BUDGET,
+    SIMD,
     GREY,
     QUANT_UNIF,
     QUANT_POP,
@@ -69,9 +94,11 @@ enum ECommands          // command ids
     DITHER_PATTERN,
     DITHER_COLOR,
     FILTER_BOX,
+    FILTER_BOX_N,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
+    FILTER_GAUSS_IIR,
     FILTER_EDGE,
     FILTER_ENHANCE,
     NPR_PAINT,
@@ -112,7 +139,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != LOAD_REGION && command != LOAD_SCALED && command != STREAM && command != RUN && command != POOL_STATS && command != LAYOUT && command != MEM_BUDGET && command != SIMD && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
@@ -143,6 +170,65 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// LOAD
 
+        case LOAD_REGION:
+        {
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            char* asArgs[4];
+            for (int i = 0; i < 4; ++i)
+                asArgs[i] = strtok(NULL, c_sWhiteSpace);
+
+            if (!sFilename || !asArgs[3])
+            {
+                cout << "Usage: load-region filename x y w h" << endl;
+                bParsed = false;
+                break;
+            }// if
+
+            TargaImage* pRegion = TargaImage::Load_Image_Region(sFilename, atoi(asArgs[0]), atoi(asArgs[1]),
+                                                                atoi(asArgs[2]), atoi(asArgs[3]));
+            bResult = pRegion != NULL;
+
+            if (bResult)
+            {
+                delete pImage;
+                pImage = pRegion;
+            }// if
+            else
+            {
+                cout << "Unable to load image region:  " << sFilename << endl;
+                bParsed = false;
+            }// else
+            break;
+        }// LOAD_REGION
+
+        case LOAD_SCALED:
+        {
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            char* sFactor = strtok(NULL, c_sWhiteSpace);
+
+            if (!sFilename || !sFactor || atoi(sFactor) < 1)
+            {
+                cout << "Usage: load-scaled filename factor" << endl;
+                bParsed = false;
+                break;
+            }// if
+
+            TargaImage* pScaled = TargaImage::Load_Image_Scaled(sFilename, atoi(sFactor));
+            bResult = pScaled != NULL;
+
+            if (bResult)
+            {
+                delete pImage;
+                pImage = pScaled;
+            }// if
+            else
+            {
+                cout << "Unable to load image:  " << sFilename << endl;
+                bParsed = false;
+            }// else
+            break;
+        }// LOAD_SCALED
+
         case SAVE:
         {
             char* sFilename = strtok(NULL, c_sWhiteSpace);
@@ -154,12 +240,155 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// SAVE
 
+        case SAVE_RLE:
+        {
+            char* sFilename = strtok(NULL, c_sWhiteSpace);
+            if (!sFilename)
+                cout << "No filename given." << endl;
+
+            bParsed = sFilename != NULL;
+            bResult =  bParsed && pImage->Save_Image_RLE(sFilename);
+            break;
+        }// SAVE_RLE
+
+        case STREAM:
+        {
+            // point operations run a band at a time without loading the image
+            char* sOperation = strtok(NULL, c_sWhiteSpace);
+            char* sInFile = strtok(NULL, c_sWhiteSpace);
+            char* sOutFile = strtok(NULL, c_sWhiteSpace);
+            bool (TargaImage::*op)() = NULL;
+
+            if (sOperation && !strcmp(sOperation, c_asCommands[GREY]))
+                op = &TargaImage::To_Grayscale;
+            else if (sOperation && !strcmp(sOperation, c_asCommands[QUANT_UNIF]))
+                op = &TargaImage::Quant_Uniform;
+            else if (sOperation && !strcmp(sOperation, c_asCommands[DITHER_THRESH]))
+                op = &TargaImage::Dither_Threshold;
+
+            if (!op)
+                cout << "Stream operation must be one of gray, quant-unif or dither-thresh." << endl;
+            else if (!sInFile || !sOutFile)
+                cout << "Usage: stream operation infile outfile" << endl;
+
+            bParsed = op && sInFile && sOutFile;
+            bResult = bParsed && TargaImage::Stream_Image(sInFile, sOutFile, op);
+            break;
+        }// STREAM
+
         case RUN:
         {
             bResult = HandleScriptFile(strtok(NULL, c_sWhiteSpace), pImage);
             break;
         }// RUN
 
+        case POOL_STATS:
+        {
+            CBufferPool::SStats stats = CBufferPool::GetStats();
+
+            cout << "Buffer pool: " << stats.hits << " of " << stats.requests << " requests reused";
+            if (stats.requests)
+                cout << " (" << 100 * stats.hits / stats.requests << "%)";
+            cout << ", " << stats.pooledBuffers << " buffers (" << stats.pooledBytes << " bytes) pooled" << endl;
+
+            bResult = true;
+            break;
+        }// POOL_STATS
+
+        case SELECT:
+        {
+            // with no rectangle the whole image is selected again
+            char* asArgs[4];
+            for (int i = 0; i < 4; ++i)
+                asArgs[i] = strtok(NULL, c_sWhiteSpace);
+
+            if (!asArgs[0])
+            {
+                pImage->Select_All();
+                bResult = true;
+                break;
+            }// if
+
+            if (!asArgs[3])
+            {
+                cout << "Usage: select [x y w h]" << endl;
+                bParsed = bResult = false;
+                break;
+            }// if
+
+            bResult = pImage->Select(atoi(asArgs[0]), atoi(asArgs[1]), atoi(asArgs[2]), atoi(asArgs[3]));
+            if (!bResult)
+                cout << "Selection lies outside the image." << endl;
+            break;
+        }// SELECT
+
+        case LAYOUT:
+        {
+            // operations with a planar version run on separate channel planes
+            char* sLayout = strtok(NULL, c_sWhiteSpace);
+
+            bParsed = sLayout && (!strcmp(sLayout, "planar") || !strcmp(sLayout, "interleaved"));
+            if (!bParsed)
+                cout << "Usage: layout planar|interleaved" << endl;
+            else
+                TargaImage::Use_Planar_Kernels(!strcmp(sLayout, "planar"));
+
+            bResult = bParsed;
+            break;
+        }// LAYOUT
+
+        case TILES:
+        {
+            // the neighbourhood filters run a 64x64 tile at a time on this image
+            char* sSwitch = strtok(NULL, c_sWhiteSpace);
+
+            bParsed = sSwitch && (!strcmp(sSwitch, "on") || !strcmp(sSwitch, "off"));
+            if (!bParsed)
+                cout << "Usage: tiles on|off" << endl;
+            else
+                pImage->Use_Tiles(!strcmp(sSwitch, "on"));
+
+            bResult = bParsed;
+            break;
+        }// TILES
+
+        case MEM_BUDGET:
+        {
+            // images loaded from now on that are bigger than this stay on disk
+            size_t  bytes;
+
+            bParsed = CTileStore::ParseSize(strtok(NULL, c_sWhiteSpace), bytes);
+            if (!bParsed)
+                cout << "Usage: mem-budget megabytes|sizeK|sizeM|sizeG" << endl;
+            else
+                CTileStore::SetBudget(bytes);
+
+            bResult = bParsed;
+            break;
+        }// MEM_BUDGET
+
+        case SIMD:
+        {
+            // the small separable filters use these vector kernels, or the
+            // best the processor has below them
+            char*   sLevel = strtok(NULL, c_sWhiteSpace);
+            int     level;
+
+            for (level = 0; sLevel && level < CFilterKernels::NUM_LEVELS; ++level)
+                if (!strcmp(sLevel, CFilterKernels::Name((CFilterKernels::ELevel)level)))
+                    break;
+
+            bParsed = sLevel && level < CFilterKernels::NUM_LEVELS;
+            if (!bParsed)
+                cout << "Usage: simd scalar|sse2|avx2|avx512" << endl;
+            else if (CFilterKernels::SetLevel((CFilterKernels::ELevel)level) != level)
+                cout << "This processor lacks " << sLevel << "; using "
+                     << CFilterKernels::Name(CFilterKernels::GetLevel()) << "." << endl;
+
+            bResult = bParsed;
+            break;
+        }// SIMD
+
         case GREY:
         {
             bResult = pImage->To_Grayscale();
@@ -220,6 +449,21 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_BOX
 
+        case FILTER_BOX_N:
+        {
+            // averages a (2R + 1) squared box, at the same cost for any R
+            char *sRadius = strtok(NULL, c_sWhiteSpace);
+
+            if (!sRadius || atoi(sRadius) < 1)
+            {
+                cout << "Usage: filter-box-n R, with R at least 1" << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Box_N(atoi(sRadius));
+            break;
+        }// FILTER_BOX_N
+
         case FILTER_BARTLETT:
         {
             bResult = pImage->Filter_Bartlett();
@@ -244,6 +488,21 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// FILTER_GUASS_N
 
+        case FILTER_GAUSS_IIR:
+        {
+            // a recursive Gaussian, at the same cost for any sigma
+            char *sSigma = strtok(NULL, c_sWhiteSpace);
+
+            if (!sSigma || !(atof(sSigma) >= 0.5))
+            {
+                cout << "Usage: filter-gauss-iir sigma, with sigma at least 0.5" << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Filter_Gaussian_IIR(atof(sSigma));
+            break;
+        }// FILTER_GAUSS_IIR
+
         case FILTER_EDGE:
         {
             bResult = pImage->Filter_Edge();
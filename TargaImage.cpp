@@ -14,6 +14,10 @@
 #include "Globals.h"
 #include "TargaImage.h"
 #include "libtarga.h"
+#include "BufferPool.h"
+#include "TileStore.h"
+#include "FilterKernels.h"
+#include "ThreadPool.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
@@ -22,6 +26,8 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <complex>
 
 using namespace std;
 
@@ -30,6 +36,18 @@ const int           RED             = 0;                // red channel
 const int           GREEN           = 1;                // green channel
 const int           BLUE            = 2;                // blue channel
 const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
+const int           PLANE_ALIGN     = 64;               // plane rows start on this many bytes
+const int           SUM_BLOCK       = 1024;             // column sums a filter adds a row to at a time
+const int           IIR_STRIP       = 32;               // columns the recursive Gaussian runs down at a time
+
+bool TargaImage::s_bPlanarKernels = false;
+
+
+// Bytes from one row of a plane to the next for an image of the given width
+static int Plane_Stride(int width)
+{
+    return (width + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+}// Plane_Stride
 
 
 // Computes n choose s, efficiently
@@ -45,12 +63,78 @@ double Binomial(int n, int s)
 }// Binomial
 
 
+// The straight colour for every alpha and premultiplied value, the
+// floor(value * 255 / alpha) in float arithmetic that RGBA_To_RGB always
+// used, worked out once so dividing out alpha is a lookup.  Alpha 0 gives
+// the black background.
+struct SUnpremultiply
+{
+    unsigned char   value[256][256];    // indexed by alpha, then premultiplied value
+
+    SUnpremultiply()
+    {
+        memset(value[0], 0, sizeof(value[0]));
+
+        for (int alpha = 1; alpha < 256; ++alpha)
+        {
+            float   alpha_scale = (float)255 / (float)alpha;
+
+            for (int i = 0; i < 256; ++i)
+            {
+                int val = (int)floor(i * alpha_scale);
+                value[alpha][i] = val < 0 ? 0 : val > 255 ? 255 : val;
+            }// for
+        }// for
+    }
+};// SUnpremultiply
+
+static const SUnpremultiply& Unpremultiply()
+{
+    static const SUnpremultiply table;
+
+    return table;
+}// Unpremultiply
+
+
+// Convert a row of premultiplied RGBA pixels to straight RGB.  Opaque rows
+// only need the alpha dropped.
+static void Unpremultiply_Row(const unsigned char *rgba, unsigned char *rgb, int width)
+{
+    int i = 0;
+
+    while (i < width && rgba[i * 4 + 3] == 255)
+        ++i;
+
+    if (i == width)
+    {
+        for (i = 0; i < width; ++i, rgba += 4, rgb += 3)
+        {
+            rgb[0] = rgba[0];
+            rgb[1] = rgba[1];
+            rgb[2] = rgba[2];
+        }// for
+        return;
+    }// if
+
+    const SUnpremultiply    &table = Unpremultiply();
+
+    for (i = 0; i < width; ++i, rgba += 4, rgb += 3)
+    {
+        const unsigned char *straight = table.value[rgba[3]];
+
+        rgb[0] = straight[rgba[0]];
+        rgb[1] = straight[rgba[1]];
+        rgb[2] = straight[rgba[2]];
+    }// for
+}// Unpremultiply_Row
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage() : width(0), height(0), data(NULL)
+TargaImage::TargaImage() : width(0), height(0), data(NULL), selX(0), selY(0), selWidth(0), selHeight(0), planes(NULL), tiles(NULL), bTiled(false), store(NULL)
 {}// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -58,9 +142,9 @@ TargaImage::TargaImage() : width(0), height(0), data(NULL)
 //      Constructor.  Initialize member variables.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h) : width(w), height(h)
+TargaImage::TargaImage(int w, int h) : width(w), height(h), selX(0), selY(0), selWidth(0), selHeight(0), planes(NULL), tiles(NULL), bTiled(false), store(NULL)
 {
-   data = new unsigned char[width * height * 4];
+   data = CBufferPool::Acquire((size_t)width * height * 4);
    ClearToBlack();
 }// TargaImage
 
@@ -71,35 +155,277 @@ TargaImage::TargaImage(int w, int h) : width(w), height(h)
 //      Constructor.  Initialize member variables to values given.
 //
 ///////////////////////////////////////////////////////////////////////////////
-TargaImage::TargaImage(int w, int h, unsigned char *d)
+TargaImage::TargaImage(int w, int h, unsigned char *d) : selX(0), selY(0), selWidth(0), selHeight(0), planes(NULL), tiles(NULL), bTiled(false), store(NULL)
 {
-    int i;
+    size_t  i;
 
     width = w;
     height = h;
-    data = new unsigned char[width * height * 4];
+    data = CBufferPool::Acquire((size_t)width * height * 4);
 
-    for (i = 0; i < width * height * 4; i++)
+    for (i = 0; i < (size_t)width * height * 4; i++)
 	    data[i] = d[i];
 }// TargaImage
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Copy Constructor.  Initialize member to that of input
+//      Copy Constructor.  Initialize member to that of input.  The pixels
+//  are shared and only copied when one of the images is written.
 //
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::TargaImage(const TargaImage& image) 
 {
    width = image.width;
    height = image.height;
-   data = NULL; 
-   if (image.data != NULL) {
-      data = new unsigned char[width * height * 4];
-      memcpy(data, image.data, sizeof(unsigned char) * width * height * 4);
+   data = image.data; 
+   selX = image.selX;
+   selY = image.selY;
+   selWidth = image.selWidth;
+   selHeight = image.selHeight;
+   planes = NULL;
+   tiles = NULL;
+   bTiled = image.bTiled;
+   if (data != NULL)
+      CBufferPool::AddRef(data);
+
+   // planes belong to one image, so a planar image's copy gets its own
+   if (image.planes != NULL) {
+      size_t bytes = (size_t)4 * height * Plane_Stride(width);
+
+      planes = CBufferPool::Acquire(bytes);
+      memcpy(planes, image.planes, bytes);
    }
+
+   // and so do tiles
+   if (image.tiles != NULL) {
+      size_t bytes = TiledView::Bytes(width, height);
+
+      tiles = CBufferPool::Acquire(bytes);
+      memcpy(tiles, image.tiles, bytes);
+   }
+
+   // and a store, which copies its scratch file
+   store = image.store ? image.store->Clone() : NULL;
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move Constructor.  Take the pixels of the input, leaving it empty.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage::TargaImage(TargaImage&& image) : width(image.width), height(image.height), data(image.data),
+    selX(image.selX), selY(image.selY), selWidth(image.selWidth), selHeight(image.selHeight), planes(image.planes),
+    tiles(image.tiles), bTiled(image.bTiled), store(image.store)
+{
+    image.width = 0;
+    image.height = 0;
+    image.data = NULL;
+    image.planes = NULL;
+    image.tiles = NULL;
+    image.store = NULL;
+    image.Select_All();
+}// TargaImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy assignment.  Share the pixels of the input.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(const TargaImage& image)
+{
+    TargaImage  copy(image);
+
+    Swap(copy);
+    return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move assignment.  Take the pixels of the input and leave it with the
+//  old contents of this image, which it frees in turn.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage& TargaImage::operator=(TargaImage&& image)
+{
+    Swap(image);
+    return *this;
+}// operator=
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Exchange size, pixels and selection with another image.  No pixels
+//  are copied.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Swap(TargaImage& image)
+{
+    std::swap(width, image.width);
+    std::swap(height, image.height);
+    std::swap(data, image.data);
+    std::swap(selX, image.selX);
+    std::swap(selY, image.selY);
+    std::swap(selWidth, image.selWidth);
+    std::swap(selHeight, image.selHeight);
+    std::swap(planes, image.planes);
+    std::swap(tiles, image.tiles);
+    std::swap(bTiled, image.bTiled);
+    std::swap(store, image.store);
+}// Swap
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Restrict later operations to the w x h rectangle at (x, y), clipped
+//  to the image.  Operations treat the rectangle as if it were the whole
+//  image, and pixels outside it are left alone.  Return false and leave
+//  the selection unchanged if the rectangle misses the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Select(int x, int y, int w, int h)
+{
+    // computed wide so a large w or h cannot wrap around
+    int right = (int)Min((ptrdiff_t)x + w, (ptrdiff_t)width);
+    int bottom = (int)Min((ptrdiff_t)y + h, (ptrdiff_t)height);
+
+    x = Max(x, 0);
+    y = Max(y, 0);
+    if (w <= 0 || h <= 0 || x >= right || y >= bottom)
+        return false;
+
+    selX = x;
+    selY = y;
+    selWidth = right - x;
+    selHeight = bottom - y;
+    return true;
+}// Select
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Select the whole image.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Select_All()
+{
+    selX = selY = selWidth = selHeight = 0;
+}// Select_All
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return a view of the selected pixels, or of the whole image if
+//  nothing is selected.
+//
+///////////////////////////////////////////////////////////////////////////////
+ImageView TargaImage::View()
+{
+    Make_Interleaved();
+
+    ImageView   view(data, width, height, width * 4);
+
+    if (!selWidth)
+        return view;
+
+    return view.Sub(selX, selY, selWidth, selHeight);
+}// View
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the interleaved RGBA pixels, bringing data up to date first if
+//  the image is planar.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* TargaImage::Pixels()
+{
+    Make_Interleaved();
+    return data;
+}// Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the selected pixels as separate planes, splitting data into
+//  planes first if the image is interleaved.  Writes through the planes
+//  reach data the next time Pixels, View or Make_Unique is called.
+//
+///////////////////////////////////////////////////////////////////////////////
+PlanarView TargaImage::Planes()
+{
+    Make_Planar();
+
+    PlanarView  planar(planes, width, height, Plane_Stride(width));
+
+    if (!selWidth)
+        return planar;
+
+    return planar.Sub(selX, selY, selWidth, selHeight);
+}// Planes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn the planar versions of operations on or off.  Off by default.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Use_Planar_Kernels(bool bUse)
+{
+    s_bPlanarKernels = bUse;
+}// Use_Planar_Kernels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Choose whether operations with a tiled version use it on this image.
+//  The tiles are made the first time such an operation runs.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Use_Tiles(bool bUse)
+{
+    bTiled = bUse;
+}// Use_Tiles
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the image as tiles, splitting data into tiles first if the
+//  image is interleaved.  Writes through the tiles reach data the next time
+//  Pixels, View or Make_Unique is called.  Tiles always cover the whole
+//  image, whatever is selected.
+//
+///////////////////////////////////////////////////////////////////////////////
+TiledView TargaImage::Tiles()
+{
+    Make_Tiled();
+    return TiledView(tiles, width, height);
+}// Tiles
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give this image its own copy of its pixels if another image shares
+//  them.  Every operation that writes to data in place calls this first.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Make_Unique()
+{
+    Make_Interleaved();
+
+    if (!data || !CBufferPool::IsShared(data))
+        return;
+
+    unsigned char   *copy = CBufferPool::Acquire((size_t)width * height * 4);
+
+    memcpy(copy, data, (size_t)width * height * 4);
+    Swap_Pixels(copy);
+    CBufferPool::Release(copy);
+}// Make_Unique
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Destructor.  Free image memory.
@@ -107,8 +433,10 @@ TargaImage::TargaImage(const TargaImage& image)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage::~TargaImage()
 {
-    if (data)
-        delete[] data;
+    CBufferPool::Release(data);
+    CBufferPool::Release(planes);
+    CBufferPool::Release(tiles);
+    delete store;
 }// ~TargaImage
 
 
@@ -121,22 +449,22 @@ TargaImage::~TargaImage()
 ///////////////////////////////////////////////////////////////////////////////
 unsigned char* TargaImage::To_RGB(void)
 {
-    unsigned char   *rgb = new unsigned char[width * height * 3];
-    int		    i, j;
+    unsigned char   *rgb;
+    int		    i;
 
+    Make_Interleaved();
     if (! data)
 	    return NULL;
 
+    rgb = new unsigned char[(size_t)width * height * 3];
+
     // Divide out the alpha
     for (i = 0 ; i < height ; i++)
     {
-	    int in_offset = i * width * 4;
-	    int out_offset = i * width * 3;
+	    size_t in_offset = (size_t)i * width * 4;
+	    size_t out_offset = (size_t)i * width * 3;
 
-	    for (j = 0 ; j < width ; j++)
-        {
-	        RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
-	    }
+	    Unpremultiply_Row(data + in_offset, rgb + out_offset, width);
     }
 
     return rgb;
@@ -146,27 +474,155 @@ unsigned char* TargaImage::To_RGB(void)
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Save the image to a targa file. Returns 1 on success, 0 on failure.
+//  The rows are written bottom-up straight from data.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Save_Image(const char *filename)
 {
-    TargaImage	*out_image = Reverse_Rows();
+    int error;
 
-    if (! out_image)
+    if (store)
+        return Save_Out_Of_Core(filename, false);
+
+    Make_Interleaved();
+    if (! data)
 	    return false;
 
-    if (!tga_write_raw(filename, width, height, out_image->data, TGA_TRUECOLOR_32))
+    if (!tga_write_raw_r(filename, width, height, data, TGA_TRUECOLOR_32, TGA_TOP_DOWN, &error))
     {
-	    cout << "TGA Save Error: %s\n", tga_error_string(tga_get_last_error());
+	    cout << "TGA Save Error: " << tga_error_string(error) << endl;
 	    return false;
     }
 
-    delete out_image;
-
     return true;
 }// Save_Image
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Save the image to a run-length encoded targa file.  Stripes of rows
+//  are compressed on the pool's threads and written in order; packets never
+//  cross a row, so the file is the same as a single-threaded encode.
+//  Returns 1 on success, 0 on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Image_RLE(const char *filename)
+{
+    if (store)
+        return Save_Out_Of_Core(filename, true);
+
+    Make_Interleaved();
+    if (! data)
+	    return false;
+
+    // keep stripes big enough to be worth handing to a thread
+    const int   c_minStripeRows = 64;
+    int         numStripes = Max(1, Min(CThreadPool::GetThreads(), height / c_minStripeRows));
+
+    vector< vector<unsigned char> >     blocks(numStripes);
+    vector<const unsigned char*>        blockData(numStripes);
+    vector<size_t>                      blockLengths(numStripes);
+    vector<int>                         blockErrors(numStripes, 0);
+
+    // stripe s covers file rows [s * height / numStripes, (s + 1) * height / numStripes)
+    CThreadPool::Parallel_Rows(numStripes, [&](int first, int last)
+    {
+        for (int s = first; s < last; ++s)
+        {
+            int firstRow = (int)((ptrdiff_t)s * height / numStripes);
+            int rows = (int)((ptrdiff_t)(s + 1) * height / numStripes) - firstRow;
+
+            blocks[s].resize(tga_rle_bound(width, rows, TGA_TRUECOLOR_32));
+            blockLengths[s] = tga_encode_rle_rows_r(data, width, height, TGA_TRUECOLOR_32, TGA_TOP_DOWN,
+                                                    firstRow, rows, &blocks[s][0], &blockErrors[s]);
+        }// for
+    });
+
+    int error = 0;
+
+    for (int s = 0; s < numStripes; ++s)
+    {
+        blockData[s] = &blocks[s][0];
+        if (blockErrors[s])
+            error = blockErrors[s];
+    }// for
+
+    if (error || !tga_write_rle_blocks_r(filename, width, height, TGA_TRUECOLOR_32, &blockData[0], &blockLengths[0], 
+                                         numStripes, &error))
+    {
+	    cout << "TGA Save Error: " << tga_error_string(error) << endl;
+	    return false;
+    }
+
+    return true;
+}// Save_Image_RLE
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Encode the image as a complete targa file in memory, run-length
+//  encoded if bCompressed is set.  The size of the file is returned in
+//  size.  The buffer comes from malloc and must be released with free()
+//  by the caller.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* TargaImage::Save_Image_Buffer(size_t& size, bool bCompressed)
+{
+    unsigned char   *buffer;
+    int             error;
+
+    size = 0;
+    Make_Interleaved();
+    if (! data)
+	    return NULL;
+
+    buffer = (unsigned char*)tga_encode_memory_r(width, height, data, TGA_TRUECOLOR_32, TGA_TOP_DOWN,
+                                                 bCompressed ? 1 : 0, &size, &error);
+    if (!buffer)
+    {
+	    cout << "TGA Save Error: " << tga_error_string(error) << endl;
+	    return NULL;
+    }
+
+    return buffer;
+}// Save_Image_Buffer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Allocator handed to libtarga so the image is decoded directly into
+//  the pixel buffer of the TargaImage passed as user data.
+//
+///////////////////////////////////////////////////////////////////////////////
+void* TargaImage::Alloc_Pixels(void* user, size_t bytes)
+{
+    TargaImage* image = static_cast<TargaImage*>(user);
+
+    // cleared first so a failed Acquire does not leave a dangling pointer
+    CBufferPool::Release(image->data);
+    CBufferPool::Release(image->planes);
+    CBufferPool::Release(image->tiles);
+    delete image->store;
+    image->data = NULL;
+    image->planes = NULL;
+    image->tiles = NULL;
+    image->store = NULL;
+
+    // libtarga is C, so running out of memory is reported as NULL rather
+    // than thrown through it
+    try
+    {
+        image->data = CBufferPool::Acquire(bytes);
+    }
+    catch (const bad_alloc&)
+    {
+        return NULL;
+    }
+
+    return image->data;
+}// Alloc_Pixels
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Load a targa image from a file.  Return a new TargaImage object which 
@@ -175,10 +631,8 @@ bool TargaImage::Save_Image(const char *filename)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage* TargaImage::Load_Image(char *filename)
 {
-    unsigned char   *temp_data;
-    TargaImage	    *temp_image;
     TargaImage	    *result;
-    int		        width, height;
+    int             error;
 
     if (!filename)
     {
@@ -186,22 +640,273 @@ TargaImage* TargaImage::Load_Image(char *filename)
         return NULL;
     }// if
 
-    temp_data = (unsigned char*)tga_load(filename, &width, &height, TGA_TRUECOLOR_32);
-    if (!temp_data)
+    // an image over the memory budget is read a band at a time into a
+    // tile store instead
+    if (CTileStore::GetBudget())
     {
-        cout << "TGA Error: %s\n", tga_error_string(tga_get_last_error());
-	    width = height = 0;
+        int         imageWidth, imageHeight, rowOrder;
+        tga_reader  *reader = tga_reader_open(filename, &imageWidth, &imageHeight, TGA_TRUECOLOR_32, &rowOrder);
+
+        if (reader && (size_t)imageWidth * imageHeight * 4 > CTileStore::GetBudget())
+            return Load_Out_Of_Core(reader, imageWidth, imageHeight, rowOrder);
+        tga_reader_close(reader);
+    }// if
+
+    // libtarga decodes top-down rows straight into the new image's buffer
+    result = new TargaImage();
+    if (!tga_load_r(filename, &result->width, &result->height, TGA_TRUECOLOR_32, TGA_TOP_DOWN, Alloc_Pixels, result, &error))
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+	    delete result;
 	    return NULL;
     }
-    temp_image = new TargaImage(width, height, temp_data);
-    free(temp_data);
 
-    result = temp_image->Reverse_Rows();
+    return result;
+}// Load_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a targa image from a complete file held in memory.  Return a new
+//  TargaImage object which must be deleted by caller.  Return NULL on
+//  failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Image_Buffer(const void *buffer, size_t size)
+{
+    TargaImage	    *result;
+    int             error;
+
+    if (!buffer)
+    {
+        cout << "No image data given." << endl;
+        return NULL;
+    }// if
 
-    delete temp_image;
+    result = new TargaImage();
+    if (!tga_decode_memory_r(buffer, size, &result->width, &result->height, TGA_TRUECOLOR_32, TGA_TOP_DOWN,
+                             Alloc_Pixels, result, &error))
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+	    delete result;
+	    return NULL;
+    }
 
     return result;
-}// Load_Image
+}// Load_Image_Buffer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load the w x h rectangle of a targa file whose top left corner is at
+//  (x, y).  Only the rectangle is decoded.  Return a new TargaImage object
+//  which must be deleted by caller.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Image_Region(char *filename, int x, int y, int w, int h)
+{
+    TargaImage	    *result;
+    int             error;
+
+    if (!filename)
+    {
+        cout << "No filename given." << endl;
+        return NULL;
+    }// if
+
+    result = new TargaImage();
+    if (!tga_load_region_r(filename, x, y, w, h, TGA_TRUECOLOR_32, TGA_TOP_DOWN, Alloc_Pixels, result, &error))
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+	    delete result;
+	    return NULL;
+    }
+
+    result->width = w;
+    result->height = h;
+
+    return result;
+}// Load_Image_Region
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Load a targa image at 1/factor of its width and height.  Each pixel
+//  is the average of a factor x factor block of the file, computed as the
+//  file is decoded, so the full size image is never in memory.  Return a
+//  new TargaImage object which must be deleted by caller.  Return NULL on
+//  failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Image_Scaled(char *filename, int factor)
+{
+    TargaImage	    *result;
+    int             error;
+
+    if (!filename)
+    {
+        cout << "No filename given." << endl;
+        return NULL;
+    }// if
+
+    result = new TargaImage();
+    if (!tga_load_scaled_r(filename, factor, &result->width, &result->height, TGA_TRUECOLOR_32, TGA_TOP_DOWN,
+                           Alloc_Pixels, result, &error))
+    {
+        cout << "TGA Error: " << tga_error_string(error) << endl;
+	    delete result;
+	    return NULL;
+    }
+
+    return result;
+}// Load_Image_Scaled
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Apply a point operation (one where each output pixel depends only on
+//  the same input pixel, like To_Grayscale, Quant_Uniform or
+//  Dither_Threshold) to the image in inFile and write the result to
+//  outFile, never holding more than bandRows rows in memory.  Rows are
+//  written in the order they are stored in the input.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Stream_Image(const char *inFile, const char *outFile, bool (TargaImage::*op)(), int bandRows)
+{
+    int         imageWidth, imageHeight, rowOrder;
+    tga_reader  *reader;
+    tga_writer  *writer;
+
+    if (!inFile || !outFile)
+    {
+        cout << "No filename given." << endl;
+        return false;
+    }// if
+
+    reader = tga_reader_open(inFile, &imageWidth, &imageHeight, TGA_TRUECOLOR_32, &rowOrder);
+    if (!reader)
+    {
+        cout << "TGA Error: " << tga_error_string(tga_get_last_error()) << endl;
+        return false;
+    }// if
+
+    writer = tga_writer_open(outFile, imageWidth, imageHeight, TGA_TRUECOLOR_32, rowOrder, 0);
+    if (!writer)
+    {
+        cout << "TGA Save Error: " << tga_error_string(tga_get_last_error()) << endl;
+        tga_reader_close(reader);
+        return false;
+    }// if
+
+    // the band is an image of its own, so the operation runs on it unchanged
+    bandRows = Max(1, Min(bandRows, imageHeight));
+    TargaImage  band(imageWidth, bandRows);
+    bool        bResult = true;
+    int         rows;
+
+    while (bResult && (rows = tga_read_band(reader, band.data, bandRows)) > 0)
+    {
+        band.height = rows;
+        bResult = (band.*op)() && tga_write_band(writer, band.Pixels(), rows);
+    }// while
+
+    tga_reader_close(reader);
+    if (!tga_writer_close(writer))
+    {
+        cout << "TGA Save Error: " << tga_error_string(tga_get_last_error()) << endl;
+        return false;
+    }// if
+
+    return bResult;
+}// Stream_Image
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read the rest of an open file into a new out-of-core image a band of
+//  64 rows at a time, so no more than a band is held in memory.  The
+//  reader is closed.  Return NULL on failure.
+//
+///////////////////////////////////////////////////////////////////////////////
+TargaImage* TargaImage::Load_Out_Of_Core(tga_reader* reader, int w, int h, int rowOrder)
+{
+    const int   bandRows = TiledView::TILE_SIZE;
+    TargaImage  *result = new TargaImage();
+
+    result->width = w;
+    result->height = h;
+    result->store = CTileStore::Create(w, h);
+    if (!result->store)
+    {
+        cout << "Unable to create a scratch file for an out-of-core image." << endl;
+        tga_reader_close(reader);
+        delete result;
+        return NULL;
+    }// if
+
+    unsigned char   *band = CBufferPool::Acquire((size_t)w * bandRows * 4);
+    ImageView       view(band, w, bandRows, w * 4);
+    int             row = 0;
+    int             rows;
+
+    while ((rows = tga_read_band(reader, band, bandRows)) > 0)
+    {
+        // a bottom-up file hands back its bottom row first, so the band is
+        // stored upside down
+        if (rowOrder == TGA_TOP_DOWN)
+            result->store->Write(0, row, view.Sub(0, 0, w, rows));
+        else
+            result->store->Write(0, h - row - rows, ImageView(view.Row(rows - 1), w, rows, -view.stride));
+        row += rows;
+    }// while
+
+    CBufferPool::Release(band);
+    tga_reader_close(reader);
+    return result;
+}// Load_Out_Of_Core
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Write an out-of-core image to a file a band of 64 rows at a time.
+//  Rows go out bottom-up, so the file is the one Save_Image or
+//  Save_Image_RLE would write.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Save_Out_Of_Core(const char* filename, bool bCompressed)
+{
+    const int   bandRows = TiledView::TILE_SIZE;
+    tga_writer  *writer;
+
+    writer = tga_writer_open(filename, width, height, TGA_TRUECOLOR_32, TGA_BOTTOM_UP, bCompressed ? 1 : 0);
+    if (!writer)
+    {
+        cout << "TGA Save Error: " << tga_error_string(tga_get_last_error()) << endl;
+        return false;
+    }// if
+
+    unsigned char   *band = CBufferPool::Acquire((size_t)width * bandRows * 4);
+    bool            bResult = true;
+
+    for (int bottom = height, rows; bResult && bottom > 0; bottom -= rows)
+    {
+        rows = Min(bandRows, bottom);
+
+        // read upside down so the band starts with its bottom row
+        store->Read(0, bottom - rows, ImageView(band + (size_t)(rows - 1) * width * 4, width, rows, -width * 4));
+        bResult = tga_write_band(writer, band, rows) != 0;
+    }// for
+
+    CBufferPool::Release(band);
+    if (!tga_writer_close(writer) || !bResult)
+    {
+        cout << "TGA Save Error: " << tga_error_string(tga_get_last_error()) << endl;
+        return false;
+    }// if
+
+    return true;
+}// Save_Out_Of_Core
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -213,17 +918,51 @@ TargaImage* TargaImage::Load_Image(char *filename)
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale()
 {
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage*) { return band.To_Grayscale(); }, 0);
+
+    if (s_bPlanarKernels)
+    {
+        PlanarView  planar = Planes();
+
+        CThreadPool::Parallel_Rows(planar.height, [&](int first, int last)
+        {
+            for (int r = first; r < last; ++r)
+            {
+                unsigned char   *red = planar.Row(RED, r);
+                unsigned char   *green = planar.Row(GREEN, r);
+                unsigned char   *blue = planar.Row(BLUE, r);
+
+                for (int i = 0; i < planar.width; ++i)
+                {
+                    int gray = 0.299 * red[i] + 0.587 * green[i] + 0.114 * blue[i];
+                    red[i] = green[i] = blue[i] = gray;
+                }// for
+            }// for
+        });
+        return true;
+    }// if
+
+    Make_Unique();
+    ImageView view = View();
+
     // added back in the rounding of the grays (since it deprecates in c++)
     // but I don't know if it will mess anything up... it did on some things.
     // gives exact answer with or without rounding...
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        int gray = 0.299 * data[i + RED]
-            + 0.587 * data[i + GREEN]
-            + 0.114 * data[i + BLUE];// +0.5;
-        data[i + RED] = gray;
-        data[i + GREEN] = gray;
-        data[i + BLUE] = gray;
-    }
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                int gray = 0.299 * pixels[i + RED]
+                    + 0.587 * pixels[i + GREEN]
+                    + 0.114 * pixels[i + BLUE];// +0.5;
+                pixels[i + RED] = gray;
+                pixels[i + GREEN] = gray;
+                pixels[i + BLUE] = gray;
+            }
+        }
+    });
     return true;
 }// To_Grayscale
 
@@ -236,17 +975,53 @@ bool TargaImage::To_Grayscale()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Uniform()
 {
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage*) { return band.Quant_Uniform(); }, 0);
+
+    if (s_bPlanarKernels)
+    {
+        PlanarView  planar = Planes();
+
+        // the loop below keeps the top 3 bits of red and green and 2 of blue
+        CThreadPool::Parallel_Rows(planar.height, [&](int first, int last)
+        {
+            for (int r = first; r < last; ++r)
+            {
+                unsigned char   *red = planar.Row(RED, r);
+                unsigned char   *green = planar.Row(GREEN, r);
+                unsigned char   *blue = planar.Row(BLUE, r);
+
+                for (int i = 0; i < planar.width; ++i)
+                {
+                    red[i] &= 0xE0;
+                    green[i] &= 0xE0;
+                    blue[i] &= 0xC0;
+                }// for
+            }// for
+        });
+        return true;
+    }// if
+
+    Make_Unique();
+    ImageView view = View();
+
     // downgrades all the ints to smaller numbers and adds .5 for rounding.
     // gives exact answers for church and wiz.
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        int newRed = data[i + RED] / 32 + 0.5;
-        int newGreen = data[i + GREEN] / 32 + 0.5;
-        int newBlue = data[i + BLUE] / 64 + 0.5;
-        // rounds back up to regular color spectrum.
-        data[i + RED] = newRed * 32;
-        data[i + GREEN] = newGreen * 32;
-        data[i + BLUE] = newBlue * 64;
-    }
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                int newRed = pixels[i + RED] / 32 + 0.5;
+                int newGreen = pixels[i + GREEN] / 32 + 0.5;
+                int newBlue = pixels[i + BLUE] / 64 + 0.5;
+                // rounds back up to regular color spectrum.
+                pixels[i + RED] = newRed * 32;
+                pixels[i + GREEN] = newGreen * 32;
+                pixels[i + BLUE] = newBlue * 64;
+            }
+        }
+    });
     return true;
 }// Quant_Uniform
 
@@ -262,41 +1037,57 @@ bool TargaImage::Quant_Uniform()
 // https://www.tutorialspoint.com/c_standard_library/c_function_qsort.htm
 // but it appears to be other places.
 int cmpfunc(const void* a, const void* b) {
-    return (*(int*)b - *(int*)a);
+    size_t  x = *(const size_t*)a;
+    size_t  y = *(const size_t*)b;
+
+    // largest first; a difference of counts could overflow an int
+    return (x < y) - (x > y);
 }
 
+// adds the colors of a view, downgraded to between 0 and 32, to a
+// 32x32x32 histogram.
+static void Populosity_Count(const ImageView& view, size_t* hist)
+{
+    for (int r = 0; r < view.height; ++r) {
+        const unsigned char *pixels = view.Row(r);
+
+        for (int i = 0; i < (view.width * 4); i += 4) {
+            // we add a num to the color position
+            hist[(pixels[i + RED] / 8) * 1024 + 
+                (pixels[i + GREEN] / 8) * 32 + 
+                pixels[i + BLUE] / 8] += 1;
+        }
+    }
+}// Populosity_Count
+
 // this comes pretty close on both, but not perfect... not sure what
 // was off.
 bool TargaImage::Quant_Populosity()
 {
-    // this downgrades all the colors and rounds them.
-    // so should be between 0 and 32
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        data[i + RED] = data[i + RED] / 8;// .0 + 0.5; // took off rounding
-        data[i + GREEN] = data[i + GREEN] / 8;// .0 + 0.5;//see what happens
-        data[i + BLUE] = data[i + BLUE] / 8;// .0 + 0.5;
-    }
-
     int cubeSize = 32 * 32 * 32;
     // sets up a histogram and one to be ordered.
 
-    int* hist = new int[cubeSize] {0};
-    int* ordHist = new int[cubeSize];
-    
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        // we add a num to the color position
-        hist[data[i + RED] * 1024 + 
-            data[i + GREEN] * 32 + 
-            data[i + BLUE]] += 1;
+    size_t* hist = new size_t[cubeSize] {0};
+    size_t* ordHist = new size_t[cubeSize];
+    ImageView view;
+
+    // the palette comes from every pixel in the image, so an out-of-core
+    // one is counted a band at a time first
+    if (store)
+        Run_Bands_Out_Of_Core([&](const ImageView& band, int) { Populosity_Count(band, hist); }, false);
+    else {
+        Make_Unique();
+        view = View();
+        Populosity_Count(view, hist);
     }
 
     copy(hist, hist + cubeSize, ordHist);
-    qsort(ordHist, (32 * 32 * 32), sizeof(int), cmpfunc);
+    qsort(ordHist, (32 * 32 * 32), sizeof(size_t), cmpfunc);
     // couldn't get these below to work so instead am using ^^^
     //sort(arrToOrd, arrToOrd + (sizeP * sizeof(arrToOrd[0])));
     //sort(ordHist, ordHist + cubeSize * sizeof(ordHist[0]));
 
-    int least_common = ordHist[255];
+    size_t least_common = ordHist[255];
     int j = 0;
 
     int colors[256][3] = { 0 };
@@ -325,43 +1116,52 @@ bool TargaImage::Quant_Populosity()
         ++i;
     } // now we should have the total 256 colors.
 
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        // bigest distance with our 32 colors is actually 56ish
-        float closest = 1000.0; 
-        int newColor[3];
-
-        for (int j = 0; j < 256; ++j) {
-            float euclidDist = sqrt(
-                pow(data[i + RED] - colors[j][RED], 2) +
-                pow(data[i + GREEN] - colors[j][GREEN], 2) +
-                pow(data[i + BLUE] - colors[j][BLUE], 2) 
-            );
-
-            if (euclidDist < closest) {
-                closest = euclidDist;
-                newColor[RED] = colors[j][RED];
-                newColor[GREEN] = colors[j][GREEN];
-                newColor[BLUE] = colors[j][BLUE];
-            }
-        }
+    delete[] hist;
+    delete[] ordHist;
 
-        // finally sets the new color to the closest
-        data[i + RED] = newColor[RED];
-        data[i + GREEN] = newColor[GREEN];
-        data[i + BLUE] = newColor[BLUE];
-    }
+    // each pixel is downgraded, set to the closest color and shifted
+    // back to the 256 slotted color scheme instead of the 1-32.
+    auto map = [&colors](const ImageView& view) {
+        CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+            for (int r = first; r < last; ++r) {
+                unsigned char *pixels = view.Row(r);
+
+                for (int i = 0; i < (view.width * 4); i += 4) {
+                    int red = pixels[i + RED] / 8;// .0 + 0.5; // took off rounding
+                    int green = pixels[i + GREEN] / 8;// .0 + 0.5;//see what happens
+                    int blue = pixels[i + BLUE] / 8;// .0 + 0.5;
+                    // bigest distance with our 32 colors is actually 56ish
+                    float closest = 1000.0; 
+                    int newColor[3];
+
+                    for (int j = 0; j < 256; ++j) {
+                        float euclidDist = sqrt(
+                            pow(red - colors[j][RED], 2) +
+                            pow(green - colors[j][GREEN], 2) +
+                            pow(blue - colors[j][BLUE], 2) 
+                        );
+
+                        if (euclidDist < closest) {
+                            closest = euclidDist;
+                            newColor[RED] = colors[j][RED];
+                            newColor[GREEN] = colors[j][GREEN];
+                            newColor[BLUE] = colors[j][BLUE];
+                        }
+                    }
 
-    // shifts the colors back to their 256 slotted color scheme
-    // instead of the 1-32.
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        data[i + RED] = data[i + RED] * 8;
-        data[i + GREEN] = data[i + GREEN] * 8;
-        data[i + BLUE] = data[i + BLUE] * 8;
-    }
+                    // finally sets the new color to the closest
+                    pixels[i + RED] = newColor[RED] * 8;
+                    pixels[i + GREEN] = newColor[GREEN] * 8;
+                    pixels[i + BLUE] = newColor[BLUE] * 8;
+                }
+            }
+        });
+    };
 
-    delete[] hist;
-    delete[] ordHist;
+    if (store)
+        return Run_Out_Of_Core([&](TargaImage& band, TargaImage*) { map(band.View()); return true; }, 0);
 
+    map(view);
     return true;
 }// Quant_Populosity
 
@@ -373,25 +1173,59 @@ bool TargaImage::Quant_Populosity()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Threshold()
 {
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage*) { return band.Dither_Threshold(); }, 0);
+
+    if (s_bPlanarKernels)
+    {
+        PlanarView  planar = Planes();
+
+        CThreadPool::Parallel_Rows(planar.height, [&](int first, int last)
+        {
+            for (int r = first; r < last; ++r)
+            {
+                unsigned char   *red = planar.Row(RED, r);
+                unsigned char   *green = planar.Row(GREEN, r);
+                unsigned char   *blue = planar.Row(BLUE, r);
+
+                for (int i = 0; i < planar.width; ++i)
+                {
+                    int gray = (0.299 * red[i] + 0.587 * green[i] + 0.114 * blue[i]) / 256.0;
+                    red[i] = green[i] = blue[i] = gray < 0.5 ? 0 : 255;
+                }// for
+            }// for
+        });
+        return true;
+    }// if
+
+    Make_Unique();
+    ImageView view = View();
+
     // i am not going to be changing it and comparing to 0.5, instead could
     // just compare to 128 as ints i think...
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        // changed it to divide by 256 and that produced
-        // exact results.
-        int gray = (0.299 * data[i + RED]
-            + 0.587 * data[i + GREEN]
-            + 0.114 * data[i + BLUE]) / 256.0;// +0.5;
-        if (gray < 0.5) {
-            data[i + RED] = 0;
-            data[i + GREEN] = 0;
-            data[i + BLUE] = 0;
-        }
-        else {
-            data[i + RED] = 255;
-            data[i + GREEN] = 255;
-            data[i + BLUE] = 255;
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                // changed it to divide by 256 and that produced
+                // exact results.
+                int gray = (0.299 * pixels[i + RED]
+                    + 0.587 * pixels[i + GREEN]
+                    + 0.114 * pixels[i + BLUE]) / 256.0;// +0.5;
+                if (gray < 0.5) {
+                    pixels[i + RED] = 0;
+                    pixels[i + GREEN] = 0;
+                    pixels[i + BLUE] = 0;
+                }
+                else {
+                    pixels[i + RED] = 255;
+                    pixels[i + GREEN] = 255;
+                    pixels[i + BLUE] = 255;
+                }
+            }
         }
-    }
+    });
     return true;
 }// Dither_Threshold
 
@@ -403,27 +1237,45 @@ bool TargaImage::Dither_Threshold()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Random()
 {
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        // this gives the [0-1) grayscale
-        float gray = (0.299 * data[i + RED]
-            + 0.587 * data[i + GREEN]
-            + 0.114 * data[i + BLUE]) / 256.0;
-        gray += ((static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 0.4))) - .2);
-
-        int newGray = (int)floor(gray * 256);
+    // the random numbers are drawn row by row, left to right, so an
+    // out-of-core image goes a band of whole rows at a time to draw them
+    // in the same order as one in memory
+    auto rows = [](const ImageView& view, int) {
+        for (int r = 0; r < view.height; ++r) {
+            unsigned char *pixels = view.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                // this gives the [0-1) grayscale
+                float gray = (0.299 * pixels[i + RED]
+                    + 0.587 * pixels[i + GREEN]
+                    + 0.114 * pixels[i + BLUE]) / 256.0;
+                gray += ((static_cast <float> (rand()) / (static_cast <float> (RAND_MAX / 0.4))) - .2);
+
+                int newGray = (int)floor(gray * 256);
+
+                if (newGray < 128) {
+                    pixels[i + RED] = 0;
+                    pixels[i + GREEN] = 0;
+                    pixels[i + BLUE] = 0;
+                }
+                else {
+                    pixels[i + RED] = 255;
+                    pixels[i + GREEN] = 255;
+                    pixels[i + BLUE] = 255;
+                }
 
-        if (newGray < 128) {
-            data[i + RED] = 0;
-            data[i + GREEN] = 0;
-            data[i + BLUE] = 0;
-        }
-        else {
-            data[i + RED] = 255;
-            data[i + GREEN] = 255;
-            data[i + BLUE] = 255;
+            }
         }
+    };
 
-    }
+    if (store)
+    {
+        Run_Bands_Out_Of_Core(rows, true);
+        return true;
+    }// if
+
+    Make_Unique();
+    rows(View(), 0);
     return true;
 }// Dither_Random
 
@@ -436,97 +1288,112 @@ bool TargaImage::Dither_Random()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_FS()
 {
-    // determines if go left or right init to left
-    // but imediately changed to right.
-    int dir = -4; 
-
-    float* grayFloats = new float[height * width * 4]{ 0.0 };
-
-    To_Grayscale();
-
-    for (int r = 0; r < height; ++r) {
-
-        dir = -1 * dir; // changes direction
-
-        // I wasn't able to quite get the two different for loops
-        // combined, it was the < >= signs that got me messed up.
-        if (r % 2 == 0) {
-            for (int c = 0; c < (width * 4); c += dir) {
-                int loc = (r * width * 4) + c;
-
-                assert(loc < (height* width * 4));
-                float newGray = data[loc] / 255.0 + grayFloats[loc];
+    if (!To_Grayscale())
+        return false;
 
-                int newVal;
-                float err;
-                // STILL NEED TO ADD IN THE SHIFTS OF THE GRAY FLOATS AND AM DONE!
-                if (newGray <= 0.5) {
-                    newVal = 0;
-                    err = newGray;
-                }
-                else {
-                    newVal = 255;
-                    err = newGray - 1;
-                }
-                // this sets the new color to black or white
-                data[loc + RED] = newVal;
-                data[loc + GREEN] = newVal;
-                data[loc + BLUE] = newVal;
-
-                // this adds to the error of the grays.
-                if ((c + dir) < (width * 4) && ((c + dir) >= 0)) {
-                    grayFloats[loc + dir] += ((7.0 / 16) * err);
-                    if ((r + 1) < height) {
-                        grayFloats[loc + dir + (width * 4)] += ((1.0 / 16) * err);
+    const int width4 = (selWidth ? selWidth : width) * 4;
+    const int bottom = selWidth ? selHeight : height;
+
+    // the errors carried into a row and those gathered for the next, a
+    // float per byte like the pixels
+    float* grayFloats = (float*)CBufferPool::Acquire((size_t)width4 * 2 * sizeof(float));
+    memset(grayFloats, 0, (size_t)width4 * 2 * sizeof(float));
+
+    // dithers a band of rows starting at row top; errors are carried across
+    // the whole image in order, so an out-of-core one goes a band at a time.
+    auto rows = [&](const ImageView& view, int top) {
+        for (int i = 0; i < view.height; ++i) {
+            int r = top + i;
+            unsigned char *pixels = view.Row(i);
+            float* errors = grayFloats + (r % 2) * width4;
+            float* below = grayFloats + ((r + 1) % 2) * width4;
+
+            // determines if go left or right, right on even rows.
+            int dir = r % 2 == 0 ? 4 : -4;
+
+            // below still holds the errors of the row before.
+            memset(below, 0, width4 * sizeof(float));
+
+            // I wasn't able to quite get the two different for loops
+            // combined, it was the < >= signs that got me messed up.
+            if (r % 2 == 0) {
+                for (int c = 0; c < width4; c += dir) {
+                    float newGray = pixels[c] / 255.0 + errors[c];
+
+                    int newVal;
+                    float err;
+                    if (newGray <= 0.5) {
+                        newVal = 0;
+                        err = newGray;
                     }
-                }
-                if ((r + 1) < height) {
-                    grayFloats[loc + (width * 4)] += ((5.0 / 16) * err);
-                    if ((c - dir) < (width * 4) && ((c - dir) >= 0)) {
-						grayFloats[loc - dir + (width * 4)] += ((3.0 / 16) * err);
+                    else {
+                        newVal = 255;
+                        err = newGray - 1;
+                    }
+                    // this sets the new color to black or white
+                    pixels[c + RED] = newVal;
+                    pixels[c + GREEN] = newVal;
+                    pixels[c + BLUE] = newVal;
+
+                    // this adds to the error of the grays.
+                    if ((c + dir) < width4 && ((c + dir) >= 0)) {
+                        errors[c + dir] += ((7.0 / 16) * err);
+                        if ((r + 1) < bottom) {
+                            below[c + dir] += ((1.0 / 16) * err);
+                        }
+                    }
+                    if ((r + 1) < bottom) {
+                        below[c] += ((5.0 / 16) * err);
+                        if ((c - dir) < width4 && ((c - dir) >= 0)) {
+                            below[c - dir] += ((3.0 / 16) * err);
+                        }
                     }
-                }
 
-            }
-        }
-        else { // going backwards
-            for (int c = ((width * 4)-4); c >= 0; c += dir) {
-                int loc = (r * width * 4) + c;
-
-                assert(loc < (height* width * 4));
-                float newGray = data[loc] / 255.0 + grayFloats[loc];
-
-                int newVal;
-                float err;
-
-                if (newGray <= 0.5) {
-                    newVal = 0;
-                    err = newGray;
-                } else {
-                    newVal = 255;
-                    err = newGray - 1;
                 }
-                // this sets the new color to black or white
-                data[loc + RED] = newVal;
-                data[loc + GREEN] = newVal;
-                data[loc + BLUE] = newVal;
-
-                // this adds to the error of the grays.
-                if ((c + dir) < (width * 4) && ((c + dir) >= 0)) {
-                    grayFloats[loc + dir] += (7.0 / 16) * err;
-                    if ((r + 1) < height) {
-                        grayFloats[loc + dir + (width * 4)] += (1.0 / 16) * err;
+            }
+            else { // going backwards
+                for (int c = (width4 - 4); c >= 0; c += dir) {
+                    float newGray = pixels[c] / 255.0 + errors[c];
+
+                    int newVal;
+                    float err;
+
+                    if (newGray <= 0.5) {
+                        newVal = 0;
+                        err = newGray;
+                    } else {
+                        newVal = 255;
+                        err = newGray - 1;
                     }
-                }
-                if ((r + 1) < height) {
-                    grayFloats[loc + (width * 4)] += (5.0 / 16) * err;
-                    if ((c - dir) < (width * 4) && ((c - dir) >= 0)) {
-						grayFloats[loc - dir + (width * 4)] += (3.0 / 16) * err;
+                    // this sets the new color to black or white
+                    pixels[c + RED] = newVal;
+                    pixels[c + GREEN] = newVal;
+                    pixels[c + BLUE] = newVal;
+
+                    // this adds to the error of the grays.
+                    if ((c + dir) < width4 && ((c + dir) >= 0)) {
+                        errors[c + dir] += (7.0 / 16) * err;
+                        if ((r + 1) < bottom) {
+                            below[c + dir] += (1.0 / 16) * err;
+                        }
+                    }
+                    if ((r + 1) < bottom) {
+                        below[c] += (5.0 / 16) * err;
+                        if ((c - dir) < width4 && ((c - dir) >= 0)) {
+                            below[c - dir] += (3.0 / 16) * err;
+                        }
                     }
                 }
             }
         }
-    }
+    };
+
+    if (store)
+        Run_Bands_Out_Of_Core(rows, true);
+    else
+        rows(View(), 0);
+
+    CBufferPool::Release(grayFloats);
     return true;
 }// Dither_FS
 
@@ -539,37 +1406,80 @@ bool TargaImage::Dither_FS()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Bright()
 {
-    To_Grayscale();
+    if (!To_Grayscale())
+        return false;
 
-    int sum = 0;
+    // the threshold comes from every pixel in the image, so an out-of-core
+    // one is counted a band at a time first.  a histogram of the grays
+    // finds the same one as sorting them all would.
+    size_t hist[256] = { 0 };
+    auto count = [&hist](const ImageView& view, int) {
+        for (int r = 0; r < view.height; ++r) {
+            const unsigned char *pixels = view.Row(r);
+
+            for (int c = 0; c < view.width; ++c)
+                ++hist[pixels[c*4]];
+        }
+    };
+    ImageView view;
+
+    if (store)
+        Run_Bands_Out_Of_Core(count, false);
+    else {
+        view = View();
+        count(view, 0);
+    }
 
-    unsigned char* arrToOrd = new unsigned char[height * width];
+    size_t sum = 0;
+    size_t sizeP = 0;
 
-    for (int i = 0; i < (height * width); ++i) {
-        sum += data[i*4];
-        arrToOrd[i] = data[i*4];
+    for (int v = 0; v < 256; ++v) {
+        sum += hist[v] * v;
+        sizeP += hist[v];
     }
 
-    int sizeP = height * width;
+    // an empty selection has nothing to dither
+    if (!sizeP)
+        return true;
+
     double avg = (sum / double(sizeP)) / 256.0;
-    int spot = (1-avg) * (sizeP);
+    size_t spot = (size_t)((1-avg) * (sizeP));
 
-    sort(arrToOrd, arrToOrd + (sizeP * sizeof(arrToOrd[0])));
+    // an all black image would otherwise look one past the end
+    if (spot >= sizeP)
+        spot = sizeP - 1;
 
-    int theSpot = arrToOrd[spot];
+    // the gray that would be at spot if they were sorted
+    int theSpot = 0;
+
+    for (size_t below = hist[0]; below <= spot; below += hist[++theSpot])
+        ;
 
     // NEED TO FIX THIS TO TAKE IN THE AVERAGE VALUE...
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        if (data[i] < theSpot) {
-            data[i + RED] = 0;
-            data[i + GREEN] = 0;
-            data[i + BLUE] = 0;
-        } else {
-            data[i + RED] = 255;
-            data[i + GREEN] = 255;
-            data[i + BLUE] = 255;
-        }
-    }
+    auto threshold = [theSpot](const ImageView& view) {
+        CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+            for (int r = first; r < last; ++r) {
+                unsigned char *pixels = view.Row(r);
+
+                for (int i = 0; i < (view.width * 4); i += 4) {
+                    if (pixels[i] < theSpot) {
+                        pixels[i + RED] = 0;
+                        pixels[i + GREEN] = 0;
+                        pixels[i + BLUE] = 0;
+                    } else {
+                        pixels[i + RED] = 255;
+                        pixels[i + GREEN] = 255;
+                        pixels[i + BLUE] = 255;
+                    }
+                }
+            }
+        });
+    };
+
+    if (store)
+        return Run_Out_Of_Core([&](TargaImage& band, TargaImage*) { threshold(band.View()); return true; }, 0);
+
+    threshold(view);
     return true;
 }// Dither_Bright
 
@@ -581,30 +1491,38 @@ bool TargaImage::Dither_Bright()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster()
 {
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage*) { return band.Dither_Cluster(); }, 0);
+
+    Make_Unique();
+
     float ditherMatrix[4][4] = { { 0.75, 0.375, 0.6250, 0.25}, \
                                 {0.0625, 1.0, 0.875, 0.4375 }, \
                                 {0.5, 0.8125, 0.9375, 0.125}, \
                                 {0.1875, 0.5625, 0.3125, 0.6875} };
 
     To_Grayscale();
+    ImageView view = View();
 
-    for (int r = 0; r < height; ++r) {
-        for (int c = 0; c < (width * 4); c += 4) {
-            int loc = (r * width * 4) + c;
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
 
-            if ((data[loc] / 255.0) < ditherMatrix[r % 4][(c / 4) % 4]) {
-                data[loc + RED] = 0;
-                data[loc + GREEN] = 0;
-                data[loc + BLUE] = 0;
-            }
-            else {
-                data[loc + RED] = 255;
-                data[loc + GREEN] = 255;
-                data[loc + BLUE] = 255;
-            }
+            for (int c = 0; c < (view.width * 4); c += 4) {
+                if ((pixels[c] / 255.0) < ditherMatrix[r % 4][(c / 4) % 4]) {
+                    pixels[c + RED] = 0;
+                    pixels[c + GREEN] = 0;
+                    pixels[c + BLUE] = 0;
+                }
+                else {
+                    pixels[c + RED] = 255;
+                    pixels[c + GREEN] = 255;
+                    pixels[c + BLUE] = 255;
+                }
 
+            }
         }
-    }
+    });
     return true;
 }// Dither_Cluster
 
@@ -637,19 +1555,33 @@ bool TargaImage::Comp_Over(TargaImage* pImage)
         return false;
     }
 
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        float alpha = (((int) data[i + 3]) / 255.0);
-
-        // looks like fx + (1-af)*gx
-        data[i + RED] = ((data[i + RED] / 255.0) + \
-            ((1.0 - alpha) * (pImage->data[i + RED] / 255.0))) * 255;
-        data[i + GREEN] = ((data[i + GREEN] / 255.0) + \
-            ((1.0 - alpha) * (pImage->data[i + GREEN] / 255.0))) * 255;
-        data[i + BLUE] = ((data[i + BLUE] / 255.0) + \
-            ((1.0 - alpha) * (pImage->data[i + BLUE] / 255.0))) * 255;
-        data[i + 3] = (alpha + \
-            ((1.0 - alpha) * (pImage->data[i + 3] / 255.0))) * 255;
-    }
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage* pOther) { return band.Comp_Over(pOther); }, 0, pImage);
+
+    Make_Unique();
+    ImageView view = View();
+    ImageView source = Matching_View(pImage);
+
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+            const unsigned char *other = source.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                float alpha = (((int) pixels[i + 3]) / 255.0);
+
+                // looks like fx + (1-af)*gx
+                pixels[i + RED] = ((pixels[i + RED] / 255.0) + \
+                    ((1.0 - alpha) * (other[i + RED] / 255.0))) * 255;
+                pixels[i + GREEN] = ((pixels[i + GREEN] / 255.0) + \
+                    ((1.0 - alpha) * (other[i + GREEN] / 255.0))) * 255;
+                pixels[i + BLUE] = ((pixels[i + BLUE] / 255.0) + \
+                    ((1.0 - alpha) * (other[i + BLUE] / 255.0))) * 255;
+                pixels[i + 3] = (alpha + \
+                    ((1.0 - alpha) * (other[i + 3] / 255.0))) * 255;
+            }
+        }
+    });
     return true;
 }// Comp_Over
 
@@ -668,18 +1600,32 @@ bool TargaImage::Comp_In(TargaImage* pImage)
         return false;
     }
 
-    for (int i = 0; i < (height * width * 4); i += 4) {
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage* pOther) { return band.Comp_In(pOther); }, 0, pImage);
 
-        float alpha = (((int) pImage->data[i + 3]) / 255.0);
+    Make_Unique();
+    ImageView view = View();
+    ImageView source = Matching_View(pImage);
 
-        // comp-in fx * gy only... no gx.
-        data[i + RED] = ((data[i + RED] / 255.0) * (alpha)) * 255;
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+            const unsigned char *other = source.Row(r);
 
-        data[i + GREEN] = ((data[i + GREEN] / 255.0) * (alpha)) * 255;
+            for (int i = 0; i < (view.width * 4); i += 4) {
 
-        data[i + BLUE] = ((data[i + BLUE] / 255.0) * (alpha)) * 255;
-        data[i + 3] = (alpha * (data[i + 3] / 255.0)) * 255;
-    }
+                float alpha = (((int) other[i + 3]) / 255.0);
+
+                // comp-in fx * gy only... no gx.
+                pixels[i + RED] = ((pixels[i + RED] / 255.0) * (alpha)) * 255;
+
+                pixels[i + GREEN] = ((pixels[i + GREEN] / 255.0) * (alpha)) * 255;
+
+                pixels[i + BLUE] = ((pixels[i + BLUE] / 255.0) * (alpha)) * 255;
+                pixels[i + 3] = (alpha * (pixels[i + 3] / 255.0)) * 255;
+            }
+        }
+    });
 
     return true;
 }// Comp_In
@@ -699,17 +1645,31 @@ bool TargaImage::Comp_Out(TargaImage* pImage)
         return false;
     }
 
-    for (int i = 0; i < (height * width * 4); i += 4) {
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage* pOther) { return band.Comp_Out(pOther); }, 0, pImage);
 
-        float alpha = (((int) pImage->data[i + 3]) / 255.0);
-        // comp-out fx * (1-gy)
-        data[i + RED] = ((data[i + RED] / 255.0) * (1.0 - alpha)) * 255;
+    Make_Unique();
+    ImageView view = View();
+    ImageView source = Matching_View(pImage);
 
-        data[i + GREEN] = ((data[i + GREEN] / 255.0) * (1.0 - alpha)) * 255;
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+            const unsigned char *other = source.Row(r);
 
-        data[i + BLUE] = ((data[i + BLUE] / 255.0) * (1.0 - alpha)) * 255;
-        data[i + 3] = ((1.0 - alpha) * (data[i + 3] / 255.0)) * 255;
-    }
+            for (int i = 0; i < (view.width * 4); i += 4) {
+
+                float alpha = (((int) other[i + 3]) / 255.0);
+                // comp-out fx * (1-gy)
+                pixels[i + RED] = ((pixels[i + RED] / 255.0) * (1.0 - alpha)) * 255;
+
+                pixels[i + GREEN] = ((pixels[i + GREEN] / 255.0) * (1.0 - alpha)) * 255;
+
+                pixels[i + BLUE] = ((pixels[i + BLUE] / 255.0) * (1.0 - alpha)) * 255;
+                pixels[i + 3] = ((1.0 - alpha) * (pixels[i + 3] / 255.0)) * 255;
+            }
+        }
+    });
 
     return true;
 }// Comp_Out
@@ -728,21 +1688,35 @@ bool TargaImage::Comp_Atop(TargaImage* pImage)
         cout << "Comp_Atop: Images not the same size\n";
         return false;
     }
+
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage* pOther) { return band.Comp_Atop(pOther); }, 0, pImage);
+
+    Make_Unique();
+    ImageView view = View();
+    ImageView source = Matching_View(pImage);
     
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        float alpha = (((int) data[i + 3]) / 255.0);
-        float pAlpha = (((int) pImage->data[i + 3]) / 255.0);
-
-        // comp-atop fx*gy + gx*(1-fy)
-        data[i + RED] = (((data[i + RED] / 255.0) * pAlpha) + \
-            ((1.0 - alpha) * (pImage->data[i + RED] / 255.0))) * 255;
-        data[i + GREEN] = (((data[i + GREEN] / 255.0) * pAlpha) + \
-            ((1.0 - alpha) * (pImage->data[i + GREEN] / 255.0))) * 255;
-        data[i + BLUE] = (((data[i + BLUE] / 255.0) * pAlpha) + \
-            ((1.0 - alpha) * (pImage->data[i + BLUE] / 255.0))) * 255;
-        data[i + 3] = ((pAlpha * alpha) + \
-            ((1.0 - alpha) * pAlpha)) * 255;
-    }
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+            const unsigned char *other = source.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                float alpha = (((int) pixels[i + 3]) / 255.0);
+                float pAlpha = (((int) other[i + 3]) / 255.0);
+
+                // comp-atop fx*gy + gx*(1-fy)
+                pixels[i + RED] = (((pixels[i + RED] / 255.0) * pAlpha) + \
+                    ((1.0 - alpha) * (other[i + RED] / 255.0))) * 255;
+                pixels[i + GREEN] = (((pixels[i + GREEN] / 255.0) * pAlpha) + \
+                    ((1.0 - alpha) * (other[i + GREEN] / 255.0))) * 255;
+                pixels[i + BLUE] = (((pixels[i + BLUE] / 255.0) * pAlpha) + \
+                    ((1.0 - alpha) * (other[i + BLUE] / 255.0))) * 255;
+                pixels[i + 3] = ((pAlpha * alpha) + \
+                    ((1.0 - alpha) * pAlpha)) * 255;
+            }
+        }
+    });
 
     return true;
 }// Comp_Atop
@@ -762,115 +1736,703 @@ bool TargaImage::Comp_Xor(TargaImage* pImage)
         return false;
     }
 
-    for (int i = 0; i < (height * width * 4); i += 4) {
-        float alpha = (((int) data[i + 3]) / 255.0);
-        float pAlpha = (((int) pImage->data[i + 3]) / 255.0);
-
-        // comp-xor fx(1-gy) + gx(1-fy)
-        data[i + RED] = (((data[i + RED] / 255.0) * (1.0-pAlpha)) + \
-            ((1.0 - alpha) * (pImage->data[i + RED] / 255.0))) * 255;
-        data[i + GREEN] = (((data[i + GREEN] / 255.0) * (1.0-pAlpha)) + \
-            ((1.0 - alpha) * (pImage->data[i + GREEN] / 255.0))) * 255;
-        data[i + BLUE] = (((data[i + BLUE] / 255.0) * (1.0-pAlpha)) + \
-            ((1.0 - alpha) * (pImage->data[i + BLUE] / 255.0))) * 255;
-        data[i + 3] = (((1-pAlpha) * alpha) + \
-            ((1.0 - alpha) * pAlpha)) * 255;
-    }
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage* pOther) { return band.Comp_Xor(pOther); }, 0, pImage);
+
+    Make_Unique();
+    ImageView view = View();
+    ImageView source = Matching_View(pImage);
+
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last) {
+        for (int r = first; r < last; ++r) {
+            unsigned char *pixels = view.Row(r);
+            const unsigned char *other = source.Row(r);
+
+            for (int i = 0; i < (view.width * 4); i += 4) {
+                float alpha = (((int) pixels[i + 3]) / 255.0);
+                float pAlpha = (((int) other[i + 3]) / 255.0);
+
+                // comp-xor fx(1-gy) + gx(1-fy)
+                pixels[i + RED] = (((pixels[i + RED] / 255.0) * (1.0-pAlpha)) + \
+                    ((1.0 - alpha) * (other[i + RED] / 255.0))) * 255;
+                pixels[i + GREEN] = (((pixels[i + GREEN] / 255.0) * (1.0-pAlpha)) + \
+                    ((1.0 - alpha) * (other[i + GREEN] / 255.0))) * 255;
+                pixels[i + BLUE] = (((pixels[i + BLUE] / 255.0) * (1.0-pAlpha)) + \
+                    ((1.0 - alpha) * (other[i + BLUE] / 255.0))) * 255;
+                pixels[i + 3] = (((1-pAlpha) * alpha) + \
+                    ((1.0 - alpha) * pAlpha)) * 255;
+            }
+        }
+    });
+
+    return true;
+}// Comp_Xor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Calculate the difference bewteen this imag and the given one.  Image 
+//  dimensions must be equal.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Difference(TargaImage* pImage)
+{
+    if (!pImage)
+        return false;
+
+    if (width != pImage->width || height != pImage->height)
+    {
+        cout << "Difference: Images not the same size\n";
+        return false;
+    }// if
+
+    if (store)
+        return Run_Out_Of_Core([](TargaImage& band, TargaImage* pOther) { return band.Difference(pOther); }, 0, pImage);
+
+    Make_Unique();
+    ImageView view = View();
+    ImageView source = Matching_View(pImage);
+    const SUnpremultiply &table = Unpremultiply();
+
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last)
+    {
+        for (int r = first; r < last; ++r)
+        {
+            unsigned char   *pixels = view.Row(r);
+            unsigned char   *other = source.Row(r);
+
+            // both pixels are divided by their alpha before differencing
+            for (int i = 0 ; i < view.width * 4 ; i += 4)
+            {
+                const unsigned char  *straight1 = table.value[pixels[i+3]];
+                const unsigned char  *straight2 = table.value[other[i+3]];
+
+                pixels[i] = abs(straight1[pixels[i]] - straight2[other[i]]);
+                pixels[i+1] = abs(straight1[pixels[i+1]] - straight2[other[i+1]]);
+                pixels[i+2] = abs(straight1[pixels[i+2]] - straight2[other[i+2]]);
+                pixels[i+3] = 255;
+            }
+        }
+    });
+
+    return true;
+}// Difference
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The column pass of Convolve_Separable, and its row pass over the
+//  pixels first to last, in the vector kernels when its sums are 16 bits.
+//  Return false for other sums, which take the loops in Convolve_Separable.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Sum>
+static bool Sum_Columns_Fixed(const vector<const unsigned char*>&, const vector<Sum>&, vector<Sum>&)
+{
+    return false;
+}// Sum_Columns_Fixed
+
+static bool Sum_Columns_Fixed(const vector<const unsigned char*>& rows, const vector<unsigned short>& weights,
+                              vector<unsigned short>& column)
+{
+    CFilterKernels::Sum_Columns(rows.data(), weights.data(), (int)weights.size(), (int)column.size(), column.data());
+    return true;
+}// Sum_Columns_Fixed
+
+template <class Sum>
+static bool Sum_Row_Fixed(const vector<Sum>&, int, const vector<Sum>&, int, int, const CFilterKernels::SDivide&,
+                          const unsigned char*, unsigned char*)
+{
+    return false;
+}// Sum_Row_Fixed
+
+static bool Sum_Row_Fixed(const vector<unsigned short>& column, int left, const vector<unsigned short>& kernel,
+                          int first, int last, const CFilterKernels::SDivide& fixed,
+                          const unsigned char* pixels, unsigned char* out)
+{
+    const int   radius = (int)kernel.size() / 2;
+
+    if (first < last)
+        CFilterKernels::Sum_Row(column.data() + (first - radius - left) * 4, kernel.data(), (int)kernel.size(),
+                                last - first, fixed, pixels + first * 4, out + first * 4);
+    return true;
+}// Sum_Row_Fixed
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter every pixel of dst with the square kernel whose weights are
+//  the products of taps, by summing each column under taps and then each
+//  row of those sums.  The sum is divided by the square of the total of
+//  taps, rounded to nearest if bRound and down otherwise.  src and dst
+//  cover the same pixels, whose top left corner is at (x0, y0) in a
+//  width x height image; a tap that falls outside the image is reflected
+//  through the centre pixel.  src must be readable out to the radius of
+//  taps around every pixel inside the image.  Alpha is copied through.
+//  Only pixels within radius of the image's left and right edges check
+//  their taps; the rest of each row runs without branches.
+//
+//  Sum must hold the total of taps squared times 255 unless bSplit, when
+//  each column sum is split into a multiple of the total and a remainder
+//  and only twice the total squared has to fit.  16-bit sums run the column
+//  pass and the pixels clear of the edges in CFilterKernels, dividing with
+//  fixed.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Sum, bool bSplit>
+static void Convolve_Separable(const ImageView& src, const ImageView& dst, int x0, int y0, int width, int height,
+                               const vector<unsigned int>& taps, bool bRound, const CFilterKernels::SDivide& fixed)
+{
+    const int   radius = (int)taps.size() / 2;
+    const vector<Sum> kernel(taps.begin(), taps.end());
+    Sum         total = 0;
+
+    for (size_t i = 0; i < kernel.size(); ++i)
+        total += kernel[i];
+
+    const Sum   divisor = total * total;
+    const Sum   bias = bRound ? divisor / 2 : 0;
+
+    // the columns whose sums a row of dst reads
+    const int   left = Max(-radius, -x0);
+    const int   right = Min(dst.width + radius, width - x0);
+
+    // the pixels of a row whose taps all land inside the image
+    const int   first = Min(dst.width, Max(0, radius - x0));
+    const int   last = Max(first, Min(dst.width, width - radius - x0));
+
+    // column sums are kept for all four channels so the loop making them
+    // runs straight; the alpha sums are not used
+    vector<const unsigned char*>    rows(kernel.size());
+    vector<Sum>                     weights(kernel.size());
+    vector<Sum>                     column((right - left) * 4);
+    vector<Sum>                     remainder(bSplit ? column.size() : 0);
+
+    // (total * sum + rest + bias) / divisor, without forming the product
+    auto divide = [&](Sum sum, Sum rest) {
+        if (bSplit)
+            return (unsigned char)((sum + (rest + bias) / total) / total);
+        return (unsigned char)((sum + bias) / divisor);
+    };
+
+    for (int r = 0; r < dst.height; ++r) {
+        const unsigned char *pixels = src.Row(r);
+        unsigned char *out = dst.Row(r);
+
+        // the rows under the kernel, with the ones off the image reflected
+        for (int y = -radius; y <= radius; ++y) {
+            int ny = y;
+
+            if (((y0 + r + y) < 0) || ((y0 + r + y) >= height)) {
+                ny = -ny;
+            }
+            rows[y + radius] = src.Row(r + ny) + left * 4;
+            weights[y + radius] = kernel[ny + radius];
+        }
+
+        // sums down the columns, a block at a time in a local array that
+        // stays in the cache and that the rows can't alias, unless the
+        // vector kernels take them
+        if (!Sum_Columns_Fixed(rows, weights, column)) {
+            for (int start = 0; start < (int)column.size(); start += SUM_BLOCK) {
+                const int count = Min((int)column.size() - start, SUM_BLOCK);
+                Sum block[SUM_BLOCK];
+
+                fill(block, block + count, 0);
+                for (size_t k = 0; k < kernel.size(); ++k) {
+                    const unsigned char *row = rows[k] + start;
+                    const Sum weight = weights[k];
+
+                    // a fixed count lets the compiler vectorize whole blocks
+                    if (count == SUM_BLOCK) {
+                        for (int i = 0; i < SUM_BLOCK; ++i)
+                            block[i] += row[i] * weight;
+                    }
+                    else {
+                        for (int i = 0; i < count; ++i)
+                            block[i] += row[i] * weight;
+                    }
+                }
+                copy(block, block + count, column.begin() + start);
+            }
+        }
+
+        if (bSplit) {
+            for (size_t i = 0; i < column.size(); ++i) {
+                remainder[i] = column[i] % total;
+                column[i] /= total;
+            }
+        }
+
+        // sums along the row for the pixels clear of the edges
+        if (!Sum_Row_Fixed(column, left, kernel, first, last, fixed, pixels, out)) {
+            for (int c = first; c < last; ++c) {
+                const Sum *from = column.data() + (c - radius - left) * 4;
+                const Sum *part = bSplit ? remainder.data() + (c - radius - left) * 4 : NULL;
+                Sum sumR = 0, sumG = 0, sumB = 0;
+                Sum restR = 0, restG = 0, restB = 0;
+
+                for (int x = 0; x <= 2 * radius; ++x) {
+                    const Sum weight = kernel[x];
+
+                    sumR += from[x * 4 + RED] * weight;
+                    sumG += from[x * 4 + GREEN] * weight;
+                    sumB += from[x * 4 + BLUE] * weight;
+                    if (bSplit) {
+                        restR += part[x * 4 + RED] * weight;
+                        restG += part[x * 4 + GREEN] * weight;
+                        restB += part[x * 4 + BLUE] * weight;
+                    }
+                }
+
+                out[c * 4 + RED] = divide(sumR, restR);
+                out[c * 4 + GREEN] = divide(sumG, restG);
+                out[c * 4 + BLUE] = divide(sumB, restB);
+                out[c * 4 + 3] = pixels[c * 4 + 3];
+            }
+        }
+
+        // and for the pixels near them, reflecting the taps off the image
+        for (int c = 0; c < dst.width; ++c) {
+            if (c == first)
+                c = last;
+            if (c == dst.width)
+                break;
+
+            Sum sum[3] = { 0, 0, 0 };
+            Sum rest[3] = { 0, 0, 0 };
+
+            for (int x = -radius; x <= radius; ++x) {
+                int nx = x;
+
+                if (((x0 + c + x) < 0) || ((x0 + c + x) >= width)) {
+                    nx = -nx;
+                }
+
+                const Sum weight = kernel[nx + radius];
+                const int i = (c + nx - left) * 4;
+
+                for (int k = 0; k < 3; ++k) {
+                    sum[k] += column[i + k] * weight;
+                    if (bSplit)
+                        rest[k] += remainder[i + k] * weight;
+                }
+            }
+
+            for (int k = 0; k < 3; ++k)
+                out[c * 4 + k] = divide(sum[k], rest[k]);
+            out[c * 4 + 3] = pixels[c * 4 + 3];
+        }
+    }
+}// Convolve_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run Convolve_Separable with sums wide enough for taps, in 16 bits
+//  when they fit and the processor has vector kernels for them.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Convolve_Separable(const ImageView& src, const ImageView& dst, int x0, int y0, int width, int height,
+                               const vector<unsigned int>& taps, bool bRound)
+{
+    double                  total = 0;
+    CFilterKernels::SDivide fixed = { 0, 0, 0 };
+
+    for (size_t i = 0; i < taps.size(); ++i)
+        total += taps[i];
+
+    if (CFilterKernels::GetLevel() != CFilterKernels::SCALAR && total * total * 255 < 65536.0 &&
+        CFilterKernels::Make_Divide((unsigned int)(total * total), bRound ? (unsigned int)(total * total) / 2 : 0,
+                                    (unsigned int)(total * total) * 255, fixed))
+        Convolve_Separable<unsigned short, false>(src, dst, x0, y0, width, height, taps, bRound, fixed);
+    else if (total * total * 256 < 4294967296.0)
+        Convolve_Separable<unsigned int, false>(src, dst, x0, y0, width, height, taps, bRound, fixed);
+    else if (total * total * 256 < 18446744073709551616.0)
+        Convolve_Separable<unsigned long long, false>(src, dst, x0, y0, width, height, taps, bRound, fixed);
+    else
+        Convolve_Separable<unsigned long long, true>(src, dst, x0, y0, width, height, taps, bRound, fixed);
+}// Convolve_Separable
+
+
+// Sum of rows lo to hi of a view in each channel, for a run of columns,
+// kept up to date as lo and hi move down the view
+struct SRowSum
+{
+    int                     lo;
+    int                     hi;
+    vector<unsigned int>    sum;    // RGBA of each column
+};// SRowSum
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move window to rows lo to hi of src, where the columns summed start
+//  at left.  Rows entering are added and rows leaving are taken off, so a
+//  window that only moves down costs O(1) rows per step on average; any
+//  other move starts the sum again.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Slide_Rows(SRowSum& window, int lo, int hi, const ImageView& src, int left)
+{
+    const int   count = (int)window.sum.size();
+    unsigned int *sum = window.sum.data();
+
+    if (lo > hi || lo < window.lo || lo > window.hi + 1 || hi < window.hi)
+    {
+        // an empty window is already all zero
+        if (window.lo <= window.hi)
+            fill(window.sum.begin(), window.sum.end(), 0);
+        window.lo = lo;
+        window.hi = lo - 1;
+    }// if
+
+    while (window.hi < hi)
+    {
+        const unsigned char *row = src.Row(++window.hi) + left * 4;
+
+        for (int i = 0; i < count; ++i)
+            sum[i] += row[i];
+    }// while
+
+    while (window.lo < lo)
+    {
+        const unsigned char *row = src.Row(window.lo++) + left * 4;
+
+        for (int i = 0; i < count; ++i)
+            sum[i] -= row[i];
+    }// while
+}// Slide_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the (2 * radius + 1) squared box around every pixel of dst to the
+//  average of the pixels under it, rounding to nearest, at a cost per pixel
+//  that does not depend on radius.  src, dst and the border rule are as
+//  for Convolve_Separable.
+//
+//  Reflecting the taps of pixel i that fall off a line of n pixels adds a
+//  second copy of the run from 2i + 1 to i + radius near the start of the
+//  line, and of the run from i - radius to 2i - n near the end, to the
+//  window clipped to the line.  Each of those runs only moves forward
+//  along the line, so columns keep running sums of rows, and rows take
+//  differences of prefix sums of the column sums.  Rows and pixels clear
+//  of the edges use the window alone.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Box_Filter(const ImageView& src, const ImageView& dst, int x0, int y0, int width, int height, int radius)
+{
+    const unsigned int  divisor = (2 * radius + 1) * (2 * radius + 1);
+
+    // the columns whose sums a row of dst reads
+    const int   left = Max(-radius, -x0);
+    const int   right = Min(dst.width + radius, width - x0);
+    const int   count = (right - left) * 4;
+
+    // the pixels of a row whose box lies inside the image
+    const int   first = Min(dst.width, Max(0, radius - x0));
+    const int   last = Max(first, Min(dst.width, width - radius - x0));
+
+    SRowSum     window[3];
+    vector<unsigned int> prefix(count + 4);
+    unsigned int *sums = prefix.data() + 4;
+
+    for (int k = 0; k < 3; ++k) {
+        window[k].lo = 0;
+        window[k].hi = -1;
+        window[k].sum.assign(count, 0);
+    }
+
+    // averages the box of pixel c of a row, adding the reflected runs
+    auto edge = [&](int c, const unsigned char *pixels, unsigned char *out) {
+        const int x = x0 + c;
+
+        // the same three runs along the row
+        int runs[3][2] = {
+            { Max(0, x - radius), Min(width - 1, x + radius) },
+            { 2 * x + 1, x < radius ? x + radius : x },
+            { x - radius, x + radius >= width ? 2 * x - width : x - radius - 1 }
+        };
+
+        for (int k = 0; k < 3; ++k) {
+            unsigned int sum = 0;
+
+            for (int j = 0; j < 3; ++j) {
+                if (runs[j][0] <= runs[j][1])
+                    sum += prefix[(runs[j][1] - x0 - left + 1) * 4 + k] - prefix[(runs[j][0] - x0 - left) * 4 + k];
+            }
+
+            out[c * 4 + k] = (unsigned char)((sum + divisor / 2) / divisor);
+        }
+        out[c * 4 + 3] = pixels[c * 4 + 3];
+    };
+
+    for (int r = 0; r < dst.height; ++r) {
+        const unsigned char *pixels = src.Row(r);
+        unsigned char *out = dst.Row(r);
+        const int g = y0 + r;
+
+        // the rows under the box, and the reflected runs at either end
+        Slide_Rows(window[0], Max(0, g - radius) - y0, Min(height - 1, g + radius) - y0, src, left);
+        Slide_Rows(window[1], 2 * g + 1 - y0, (g < radius ? g + radius : g) - y0, src, left);
+        Slide_Rows(window[2], g - radius - y0, (g + radius >= height ? 2 * g - height : g - radius - 1) - y0, src, left);
+
+        // prefix sums along the row of the column sums; they may wrap,
+        // but every difference taken fits
+        const unsigned int *column = window[0].sum.data();
+
+        if (g < radius || g + radius >= height) {
+            for (int i = 0; i < count; ++i)
+                sums[i] = sums[i - 4] + column[i] + window[1].sum[i] + window[2].sum[i];
+        }
+        else {
+            for (int i = 0; i < count; ++i)
+                sums[i] = sums[i - 4] + column[i];
+        }
+
+        // pixels clear of the edges
+        for (int c = first; c < last; ++c) {
+            const int high = (c + radius - left + 1) * 4;
+            const int low = (c - radius - left) * 4;
+
+            for (int k = 0; k < 3; ++k)
+                out[c * 4 + k] = (unsigned char)((prefix[high + k] - prefix[low + k] + divisor / 2) / divisor);
+            out[c * 4 + 3] = pixels[c * 4 + 3];
+        }
+
+        for (int c = 0; c < first; ++c)
+            edge(c, pixels, out);
+        for (int c = last; c < dst.width; ++c)
+            edge(c, pixels, out);
+    }
+}// Box_Filter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The recursive Gaussian of Young and van Vliet, split into its poles:
+//  a real one, and a complex pair whose halves give conjugate outputs.
+//  Each pole p runs v[k] = x[k] + p * v[k-1] along a line, and the pass is
+//  the sum of the v[k] times their gains, run forward and then backward.
+//  A line reflected through its end pixels, as the other filters reflect,
+//  repeats every period pixels, and so does each v; running a period from
+//  rest and multiplying by repeat gives the value it repeats with, so a
+//  line costs the same for any sigma.  Summing the poles one by one, rather
+//  than running the third-order recursion, keeps that exact when sigma is
+//  far larger than the line.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct SRecursiveGauss
+{
+    int     period;
+    double  pole;
+    double  gain;
+    double  repeat;                 // 1 / (1 - pole^period)
+    double  pair[2];                // real and imaginary parts of one of the pair
+    double  pairGain[2];            // twice its gain, as the conjugate adds the same
+    double  pairRepeat[2];
+};// SRecursiveGauss
+
+static SRecursiveGauss Recursive_Gauss(double sigma, int length)
+{
+    typedef complex<double> Complex;
+
+    SRecursiveGauss gauss;
+    const double    q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+    const double    m0 = 1.16680;                   // the poles are q / (q + m0) and q / (q + m)
+    const Complex   m(1.10783, 1.40586);
+    const int       period = Max(1, 2 * (length - 1));
+
+    // the gains of the partial fractions of (1 - pole) |1 - pair|^2, over
+    // the product of 1 - p / z for the poles p, at the poles z
+    const double    scale = m0 / (q + m0) * norm(m / (q + m));
+    const Complex   pair = q / (q + m);
+    const Complex   gain = scale * (q + m0) / (m0 - m) * (q + conj(m)) / (conj(m) - m);
 
-    return true;
-}// Comp_Xor
+    gauss.period = period;
+    gauss.pole = q / (q + m0);
+    gauss.gain = scale * norm((q + m) / (m - m0));
+    gauss.pair[0] = pair.real();
+    gauss.pair[1] = pair.imag();
+    gauss.pairGain[0] = 2 * gain.real();
+    gauss.pairGain[1] = 2 * gain.imag();
+
+    // 1 - p^period for p = 1 / (1 + a / q), worked from logarithms so that
+    // it stays exact when it is small
+    const double    t = period * 0.5 * log1p((2 * m.real() + norm(m) / q) / q);
+    const double    angle = period * atan2(m.imag() / q, 1 + m.real() / q);
+    const double    half = sin(angle / 2);
+    const Complex   pairRepeat = 1.0 / Complex(-expm1(-t) + exp(-t) * 2 * half * half, exp(-t) * sin(angle));
+
+    gauss.repeat = -1 / expm1(-period * log1p(m0 / q));
+    gauss.pairRepeat[0] = pairRepeat.real();
+    gauss.pairRepeat[1] = pairRepeat.imag();
+
+    return gauss;
+}// Recursive_Gauss
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Calculate the difference bewteen this imag and the given one.  Image 
-//  dimensions must be equal.  Return success of operation.
+//      Filter count lines held side by side in line, a period of each, with
+//  a recursive Gaussian pass forward and then one backward.  Each pass runs
+//  the period twice: once from rest to find the values it repeats with,
+//  and once from them writing the output.  state holds 3 * count values.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Difference(TargaImage* pImage)
+static void Recursive_Filter(double* line, int count, const SRecursiveGauss& gauss, double* state)
 {
-    if (!pImage)
-        return false;
+    const double    p = gauss.pole, g = gauss.gain;
+    const double    pr = gauss.pair[0], pi = gauss.pair[1];
+    const double    gr = gauss.pairGain[0], gi = gauss.pairGain[1];
+    double          *v = state, *vr = state + count, *vi = state + 2 * count;
 
-    if (width != pImage->width || height != pImage->height)
+    for (int pass = 0; pass < 2; ++pass)
     {
-        cout << "Difference: Images not the same size\n";
+        fill(state, state + 3 * count, 0.0);
+
+        for (int bWrite = 0; bWrite < 2; ++bWrite)
+        {
+            if (bWrite)
+            {
+                for (int j = 0; j < count; ++j)
+                {
+                    double  re = vr[j], im = vi[j];
+
+                    v[j] *= gauss.repeat;
+                    vr[j] = re * gauss.pairRepeat[0] - im * gauss.pairRepeat[1];
+                    vi[j] = re * gauss.pairRepeat[1] + im * gauss.pairRepeat[0];
+                }// for
+            }// if
+
+            for (int k = 0; k < gauss.period; ++k)
+            {
+                double  *x = line + (ptrdiff_t)(pass ? gauss.period - 1 - k : k) * count;
+
+                for (int j = 0; j < count; ++j)
+                {
+                    double  re = x[j] + pr * vr[j] - pi * vi[j];
+
+                    vi[j] = pr * vi[j] + pi * vr[j];
+                    vr[j] = re;
+                    v[j] = x[j] + p * v[j];
+                    if (bWrite)
+                        x[j] = g * v[j] + gr * vr[j] - gi * vi[j];
+                }// for
+            }// for
+        }// for
+    }// for
+}// Recursive_Filter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a neighbourhood filter over the selection, or over each tile in
+//  turn if the image uses tiles, nothing is selected and radius fits in a
+//  tile's halo.  filter reads src out to radius around each pixel of dst,
+//  and runs on several bands of rows, or of tiles, at once.  The selection
+//  must be at least 2 * radius + 1 pixels each way.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Window(int radius, const function<void(const ImageView&, const ImageView&, int, int, int, int)>& filter)
+{
+    if ((selWidth ? Min(selWidth, selHeight) : Min(width, height)) < 2 * radius + 1)
+    {
+        cout << "The " << 2 * radius + 1 << "x" << 2 * radius + 1 << " filter does not fit in the image." << endl;
         return false;
     }// if
 
-    for (int i = 0 ; i < width * height * 4 ; i += 4)
+    if (store)
+        return Run_Out_Of_Core([&](TargaImage& band, TargaImage*) { return band.Filter_Window(radius, filter); }, radius);
+
+    if (bTiled && !selWidth && radius <= TiledView::TILE_SIZE)
     {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
+        const int       size = TiledView::TILE_SIZE + 2 * radius;
+        TiledView       grid = Tiles();
+        unsigned char   *output = CBufferPool::Acquire(TiledView::Bytes(width, height));
+        TiledView       dest(output, width, height);
+
+        // each tile is filtered from a copy of it with its border, made in
+        // a buffer of the band of tile rows it is in
+        CThreadPool::Parallel_Rows(grid.tilesDown, [&](int first, int last)
+        {
+            unsigned char   *halo = CBufferPool::Acquire((size_t)size * size * 4);
 
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
+            for (int ty = first; ty < last; ++ty)
+                for (int tx = 0; tx < grid.tilesAcross; ++tx)
+                    filter(grid.Halo(tx, ty, radius, halo), dest.Tile(tx, ty), tx * TiledView::TILE_SIZE,
+                           ty * TiledView::TILE_SIZE, width, height);
 
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i+1] = abs(rgb1[1] - rgb2[1]);
-        data[i+2] = abs(rgb1[2] - rgb2[2]);
-        data[i+3] = 255;
-    }
+            CBufferPool::Release(halo);
+        });
+
+        std::swap(tiles, output);
+        CBufferPool::Release(output);
+        return true;
+    }// if
+
+    ImageView view = View();
+    unsigned char *temp;
+    ImageView dest = Output_View(temp);
+
+    // a band reads the rows around it from the rest of the selection, so
+    // it sees the same neighbours as the whole would
+    CThreadPool::Parallel_Rows(view.height, [&](int first, int last)
+    {
+        filter(view.Sub(0, first, view.width, last - first), dest.Sub(0, first, view.width, last - first),
+               0, first, view.width, view.height);
+    });
+
+    // the filtered pixels replace the selection
+    Commit_Output(temp);
 
     return true;
-}// Difference
+}// Filter_Window
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 box filter on this image.  Return success of operation.
+//      Run the separable filter whose weights from -radius to radius along
+//  either axis are taps.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Box()
+bool TargaImage::Filter_Separable(const vector<unsigned int>& taps, bool bRound)
 {
-    unsigned char *temp = new unsigned char[width * height * 4];
+    return Filter_Window((int)taps.size() / 2, [&](const ImageView& src, const ImageView& dst, int x0, int y0, int w, int h) {
+        Convolve_Separable(src, dst, x0, y0, w, h, taps, bRound);
+    });
+}// Filter_Separable
 
-    copy(data, data + (width * height * 4), temp);
 
-    // goes through all the rows of the image
-    for (int r = 0; r < (height); ++r) {
-        // goes through each set of 4 pixels
-        for (int c = 0; c < (width * 4); c += 4) {
-            // find location of current 'pixel' in data
-			int loc = (r * width * 4) + (c);
-            // here is where we go around the pixels and add them up.
-            int sumR = 0;
-            int sumG = 0;
-            int sumB = 0;
-            for (int y = -2; y <= 2; ++y) {
-                for (int x = -2; x <= 2; ++x) {
-
-                    int ny = y;
-                    int nx = x;
-
-                    if (((r + y) < 0) || ((r + y) >= height)) {
-                        ny = -ny;
-                    }
-                    if (((c + (x*4)) < 0) || ((c + (x*4)) >= (width * 4))) {
-                        nx = -nx;
-                    }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 box filter on this image.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box()
+{
+    return Filter_Box_N(2);
+}// Filter_Box
 
-                    int shift = (ny * width * 4) + (nx * 4);
-                    
-                    sumR += data[loc + shift + RED];
-                    sumG += data[loc + shift + GREEN];
-                    sumB += data[loc + shift + BLUE];
-                }
-            }
-            // so i think this is broken because it is a (1/9)
-            // so i think it's broken because it's 25 and not 9
-            temp[loc + RED] = sumR  / 25.0 + 0.5;
-            temp[loc + GREEN] = sumG / 25.0 + 0.5;
-            temp[loc + BLUE] = sumB / 25.0 + 0.5;
-        }
-    } // after both row column for loops.
-    // copy the adjusted values back into the data.. i think
-    copy(temp, temp + (width * height * 4), data);
 
-    delete[] temp;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform a box filter of the given radius on this image, averaging a
+//  (2 * radius + 1) squared window with running sums.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box_N(int radius)
+{
+    if (radius < 0)
+        return false;
 
-    return true;
-}// Filter_Box
+    return Filter_Window(radius, [=](const ImageView& src, const ImageView& dst, int x0, int y0, int w, int h) {
+        Box_Filter(src, dst, x0, y0, w, h, radius);
+    });
+}// Filter_Box_N
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -881,53 +2443,12 @@ bool TargaImage::Filter_Box()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Bartlett()
 {
-    unsigned char *temp = new unsigned char[width * height * 4];
-
-    copy(data, data + (width * height * 4), temp);
-
-    // goes through all the rows of the image
-    for (int r = 0; r < (height); ++r) {
-        // goes through each set of 4 pixels
-        for (int c = 0; c < (width * 4); c += 4) {
-            // find location of current 'pixel' in data
-			int loc = (r * width * 4) + (c);
-            // here is where we go around the pixels and add them up.
-            int sumR = 0;
-            int sumG = 0;
-            int sumB = 0;
-            for (int y = -2; y <= 2; ++y) {
-                for (int x = -2; x <= 2; ++x) {
-
-                    int ny = y;
-                    int nx = x;
-
-                    if (((r + y) < 0) || ((r + y) >= height)) {
-                        ny = -ny;
-                    }
-                    if (((c + (x*4)) < 0) || ((c + (x*4)) >= (width * 4))) {
-                        nx = -nx;
-                    }
-
-                    int shift = (ny * width * 4) + (nx * 4);
-                    
-                    sumR += data[loc + shift + RED] * (3 - abs(ny)) * (3 - abs(nx));
-                    sumG += data[loc + shift + GREEN] * (3 - abs(ny)) * (3 - abs(nx));
-                    sumB += data[loc + shift + BLUE] * (3 - abs(ny)) * (3 - abs(nx));
-                }
-            }
-
-            // divides by the total and adds 0.5 for rounding.
-            temp[loc + RED] = sumR  / 81.0 + 0.5;
-            temp[loc + GREEN] = sumG / 81.0 + 0.5;
-            temp[loc + BLUE] = sumB / 81.0 + 0.5;
-        }
-    } // after both row column for loops.
-    // copy the adjusted values back into the data.. i think
-    copy(temp, temp + (width * height * 4), data);
+    vector<unsigned int> taps(5);
 
-    delete[] temp;
+    for (int x = 0; x < 5; ++x)
+        taps[x] = 3 - abs(x - 2);
 
-    return true;
+    return Filter_Separable(taps, true);
 }// Filter_Bartlett
 
 
@@ -939,121 +2460,144 @@ bool TargaImage::Filter_Bartlett()
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Gaussian()
 {
-    unsigned char *temp = new unsigned char[width * height * 4];
+    vector<unsigned int> taps(5);
 
-    copy(data, data + (width * height * 4), temp);
+    for (int x = 0; x < 5; ++x)
+        taps[x] = (unsigned int)Binomial(4, x);
 
-    // goes through all the rows of the image
-    for (int r = 0; r < (height); ++r) {
-        // goes through each set of 4 pixels
-        for (int c = 0; c < (width * 4); c += 4) {
-            // find location of current 'pixel' in data
-			int loc = (r * width * 4) + (c);
-            // here is where we go around the pixels and add them up.
-            int sumR = 0;
-            int sumG = 0;
-            int sumB = 0;
-            for (int y = -2; y <= 2; ++y) {
-                for (int x = -2; x <= 2; ++x) {
+    return Filter_Separable(taps, true);
+}// Filter_Gaussian
 
-                    int ny = y;
-                    int nx = x;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform NxN Gaussian filter on this image, rounding down.  The
+//  weights are row N - 1 of Pascal's triangle; past N = 31 the square of
+//  their total overflows the sums, and the recursive Gaussian of the same
+//  variance is run instead, which refuses out-of-core images.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
 
-                    if (((r + y) < 0) || ((r + y) >= height)) {
-                        ny = -ny;
-                    }
-                    if (((c + (x*4)) < 0) || ((c + (x*4)) >= (width * 4))) {
-                        nx = -nx;
-                    }
+bool TargaImage::Filter_Gaussian_N( unsigned int N )
+{
+    if (N > 31)
+        return Filter_Gaussian_IIR(sqrt((N - 1) / 4.0));
 
-                    int shift = (ny * width * 4) + (nx * 4);
-                    
-                    sumR += data[loc + shift + RED] * (Binomial(4, (ny + 2))) * (Binomial(4, (nx + 2)));
-                    sumG += data[loc + shift + GREEN] * (Binomial(4, (ny + 2))) * (Binomial(4, (nx + 2)));
-                    sumB += data[loc + shift + BLUE] * (Binomial(4, (ny + 2))) * (Binomial(4, (nx + 2)));
-                }
-            }
-            // so i think this is broken because it is a (1/9)
-            // so i think it's broken because it's 25 and not 9
-            temp[loc + RED] = sumR / 256.0 + 0.5;
-            temp[loc + GREEN] = sumG / 256.0 + 0.5;
-            temp[loc + BLUE] = sumB / 256.0 + 0.5;
+    // since it's int, it will decrement.
+    int halfN = N / 2;
+    vector<unsigned int> taps(2 * halfN + 1);
 
-        }
-    } // after both row column for loops.
-    // copy the adjusted values back into the data.. i think
-    copy(temp, temp + (width * height * 4), data);
+    for (int x = 0; x <= 2 * halfN; ++x)
+        taps[x] = (unsigned int)Binomial(N - 1, x);
 
-    delete[] temp;
+    return Filter_Separable(taps, false);
+}// Filter_Gaussian_N
 
-    return true;
-}// Filter_Gaussian
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform NxN Gaussian filter on this image.  Return success of 
-//  operation.
+//      Blur the image with a Gaussian of the given standard deviation, made
+//  by recursive passes along the rows and then down the columns, so the
+//  cost per pixel does not depend on sigma.  The selection is reflected
+//  through its edge pixels.  Every pixel of a line reaches every other, so
+//  an out-of-core image is refused.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-
-bool TargaImage::Filter_Gaussian_N( unsigned int N )
+bool TargaImage::Filter_Gaussian_IIR(double sigma)
 {
-    // since it's int, it will decrement.
-    int halfN = N / 2;
-	long int divisor = pow(2, 2 * (N - 1));
+    if (!(sigma >= 0.5))
+    {
+        cout << "The recursive Gaussian needs a sigma of at least 0.5." << endl;
+        return false;
+    }// if
+
+    if (store)
+    {
+        cout << "The recursive Gaussian needs the whole image in memory; raise the memory budget above its size." << endl;
+        return false;
+    }// if
 
-    unsigned char *temp = new unsigned char[width * height * 4];
+    ImageView       view = View();
+    unsigned char   *temp;
+    ImageView       dest = Output_View(temp);
+    const int       w = view.width;
+    const int       h = view.height;
+    float           *across = (float*)CBufferPool::Acquire((size_t)w * h * 3 * sizeof(float));
 
-    copy(data, data + (width * height * 4), temp);
+    // along the rows, a row at a time
+    const SRecursiveGauss   rowGauss = Recursive_Gauss(sigma, w);
 
-    // goes through all the rows of the image
-    for (int r = 0; r < (height); ++r) {
-        // goes through each set of 4 pixels
-        for (int c = 0; c < (width * 4); c += 4) {
-            // find location of current 'pixel' in data
-			int loc = (r * width * 4) + (c);
-            // here is where we go around the pixels and add them up.
-            long int sumR = 0;
-            long int sumG = 0;
-            long int sumB = 0;
+    CThreadPool::Parallel_Rows(h, [&](int first, int last)
+    {
+        vector<double>  line((size_t)rowGauss.period * 3);
+        vector<double>  state(3 * 3);
 
-            // these -2 / 2 will be based on (SIZE-1) / 2
-            for (int y = (-1 * halfN); y <= (halfN); ++y) {
-                for (int x = (-1 * halfN); x <= (halfN); ++x) {
+        for (int r = first; r < last; ++r)
+        {
+            const unsigned char *pixels = view.Row(r);
 
-                    int ny = y;
-                    int nx = x;
+            for (int k = 0; k < rowGauss.period; ++k)
+            {
+                int x = k < w ? k : rowGauss.period - k;
 
-                    if (((r + y) < 0) || ((r + y) >= height)) {
-                        ny = -ny;
-                    }
-                    if (((c + (x*4)) < 0) || ((c + (x*4)) >= (width * 4))) {
-                        nx = -nx;
-                    }
+                for (int c = 0; c < 3; ++c)
+                    line[k * 3 + c] = pixels[x * 4 + c];
+            }// for
 
-                    int shift = (ny * width * 4) + (nx * 4);
-                    
-                    int mult = (Binomial(N - 1, (ny + halfN))) * (Binomial(N - 1, (nx + halfN)));
-                    // these 2's will be replaced with the edge
-                    sumR += (data[loc + shift + RED] * mult);
-                    sumG += (data[loc + shift + GREEN] * mult);
-                    sumB += (data[loc + shift + BLUE] * mult);
-                }
-            }
+            Recursive_Filter(line.data(), 3, rowGauss, state.data());
 
-            // this 256 will have to be replaced with something...
-            temp[loc + RED] = floor((1.0 * sumR / divisor));// +0.5);
-            temp[loc + GREEN] = floor((1.0 * sumG / divisor));// +0.5);
-            temp[loc + BLUE] = floor((1.0 * sumB / divisor));// +0.5);
-        }
-    } // after both row column for loops.
-    // copy the adjusted values back into the data.. i think
-    copy(temp, temp + (width * height * 4), data);
+            float   *out = across + (size_t)r * w * 3;
+
+            for (int i = 0; i < w * 3; ++i)
+                out[i] = (float)line[i];
+        }// for
+    });
+
+    // and down the columns, a strip of them at a time
+    const SRecursiveGauss   columnGauss = Recursive_Gauss(sigma, h);
+
+    CThreadPool::Parallel_Rows((w + IIR_STRIP - 1) / IIR_STRIP, [&](int first, int last)
+    {
+        vector<double>  line((size_t)columnGauss.period * IIR_STRIP * 3);
+        vector<double>  state(3 * IIR_STRIP * 3);
+
+        for (int strip = first; strip < last; ++strip)
+        {
+            const int   left = strip * IIR_STRIP;
+            const int   count = Min(IIR_STRIP, w - left) * 3;
+
+            for (int k = 0; k < columnGauss.period; ++k)
+            {
+                const float *in = across + ((size_t)(k < h ? k : columnGauss.period - k) * w + left) * 3;
 
-    delete[] temp;
+                copy(in, in + count, line.begin() + (ptrdiff_t)k * count);
+            }// for
+
+            Recursive_Filter(line.data(), count, columnGauss, state.data());
+
+            for (int r = 0; r < h; ++r)
+            {
+                const unsigned char *pixels = view.Row(r) + left * 4;
+                unsigned char       *out = dest.Row(r) + left * 4;
+                const double        *sums = line.data() + (ptrdiff_t)r * count;
+
+                for (int i = 0; i < count / 3; ++i)
+                {
+                    for (int c = 0; c < 3; ++c)
+                        out[i * 4 + c] = (unsigned char)Min(255.0, Max(0.0, floor(sums[i * 3 + c] + 0.5)));
+                    out[i * 4 + 3] = pixels[i * 4 + 3];
+                }// for
+            }// for
+        }// for
+    });
+
+    CBufferPool::Release(across);
+
+    // the filtered pixels replace the selection
+    Commit_Output(temp);
 
     return true;
-}// Filter_Gaussian_N
+}// Filter_Gaussian_IIR
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1156,33 +2700,12 @@ bool TargaImage::Rotate(float angleDegrees)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
 {
-    const unsigned char	BACKGROUND[3] = { 0, 0, 0 };
+    // a black background shows through where alpha is 0
+    const unsigned char *straight = Unpremultiply().value[rgba[3]];
 
-    unsigned char  alpha = rgba[3];
-
-    if (alpha == 0)
-    {
-        rgb[0] = BACKGROUND[0];
-        rgb[1] = BACKGROUND[1];
-        rgb[2] = BACKGROUND[2];
-    }
-    else
-    {
-	    float	alpha_scale = (float)255 / (float)alpha;
-	    int	val;
-	    int	i;
-
-	    for (i = 0 ; i < 3 ; i++)
-	    {
-	        val = (int)floor(rgba[i] * alpha_scale);
-	        if (val < 0)
-		    rgb[i] = 0;
-	        else if (val > 255)
-		    rgb[i] = 255;
-	        else
-		    rgb[i] = val;
-	    }
-    }
+    rgb[0] = straight[rgba[0]];
+    rgb[1] = straight[rgba[1]];
+    rgb[2] = straight[rgba[2]];
 }// RGA_To_RGB
 
 
@@ -1194,17 +2717,20 @@ void TargaImage::RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb)
 ///////////////////////////////////////////////////////////////////////////////
 TargaImage* TargaImage::Reverse_Rows(void)
 {
-    unsigned char   *dest = new unsigned char[width * height * 4];
+    unsigned char   *dest;
     TargaImage	    *result;
     int 	        i, j;
 
+    Make_Interleaved();
     if (! data)
     	return NULL;
 
+    dest = CBufferPool::Acquire((size_t)width * height * 4);
+
     for (i = 0 ; i < height ; i++)
     {
-	    int in_offset = (height - i - 1) * width * 4;
-	    int out_offset = i * width * 4;
+	    size_t in_offset = (size_t)(height - i - 1) * width * 4;
+	    size_t out_offset = (size_t)i * width * 4;
 
 	    for (j = 0 ; j < width ; j++)
         {
@@ -1215,12 +2741,352 @@ TargaImage* TargaImage::Reverse_Rows(void)
         }
     }
 
-    result = new TargaImage(width, height, dest);
-    delete[] dest;
+    result = new TargaImage();
+    result->width = width;
+    result->height = height;
+    result->Swap_Pixels(dest);
     return result;
 }// Reverse_Rows
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make the given pool buffer this image's pixel data, handing the old
+//  pixels back through the same reference for the caller to release.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Swap_Pixels(unsigned char*& buffer)
+{
+    std::swap(data, buffer);
+}// Swap_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the rectangle of another image, the same size as this one,
+//  that lies under this image's selection.
+//
+///////////////////////////////////////////////////////////////////////////////
+ImageView TargaImage::Matching_View(TargaImage* pImage) const
+{
+    pImage->Make_Interleaved();
+
+    ImageView   view(pImage->data, pImage->width, pImage->height, pImage->width * 4);
+
+    if (!selWidth)
+        return view;
+
+    return view.Sub(selX, selY, selWidth, selHeight);
+}// Matching_View
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bring data up to date from the planes, tiles or store and drop them.
+//  Every pixel is rewritten, so pixels shared with a copy are let go rather
+//  than copied.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Make_Interleaved()
+{
+    if (!planes && !tiles && !store)
+        return;
+
+    if (!data || CBufferPool::IsShared(data))
+    {
+        CBufferPool::Release(data);
+        data = NULL;
+        data = CBufferPool::Acquire((size_t)width * height * 4);
+    }// if
+
+    // the whole of an out-of-core image comes into memory
+    if (store)
+    {
+        store->Read(0, 0, ImageView(data, width, height, width * 4));
+        delete store;
+        store = NULL;
+        return;
+    }// if
+
+    if (tiles)
+    {
+        TiledView   grid(tiles, width, height);
+
+        for (TileIterator it(grid); !it.Done(); it.Next())
+        {
+            ImageView   tile = it.Tile();
+
+            for (int r = 0; r < tile.height; ++r)
+                memcpy(data + ((size_t)(it.Y() + r) * width + it.X()) * 4, tile.Row(r), tile.width * 4);
+        }// for
+
+        CBufferPool::Release(tiles);
+        tiles = NULL;
+        return;
+    }// if
+
+    PlanarView  planar(planes, width, height, Plane_Stride(width));
+
+    for (int r = 0; r < height; ++r)
+    {
+        unsigned char       *pixels = data + (size_t)r * width * 4;
+        const unsigned char *red = planar.Row(RED, r);
+        const unsigned char *green = planar.Row(GREEN, r);
+        const unsigned char *blue = planar.Row(BLUE, r);
+        const unsigned char *alpha = planar.Row(3, r);
+
+        for (int i = 0; i < width; ++i)
+        {
+            pixels[i * 4 + RED] = red[i];
+            pixels[i * 4 + GREEN] = green[i];
+            pixels[i * 4 + BLUE] = blue[i];
+            pixels[i * 4 + 3] = alpha[i];
+        }// for
+    }// for
+
+    CBufferPool::Release(planes);
+    planes = NULL;
+}// Make_Interleaved
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split data into planes, which then hold the current pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Make_Planar()
+{
+    if (planes || (!data && !store))
+        return;
+
+    Make_Interleaved();
+
+    int stride = Plane_Stride(width);
+
+    planes = CBufferPool::Acquire((size_t)4 * height * stride);
+
+    PlanarView  planar(planes, width, height, stride);
+
+    for (int r = 0; r < height; ++r)
+    {
+        const unsigned char *pixels = data + (size_t)r * width * 4;
+        unsigned char       *red = planar.Row(RED, r);
+        unsigned char       *green = planar.Row(GREEN, r);
+        unsigned char       *blue = planar.Row(BLUE, r);
+        unsigned char       *alpha = planar.Row(3, r);
+
+        for (int i = 0; i < width; ++i)
+        {
+            red[i] = pixels[i * 4 + RED];
+            green[i] = pixels[i * 4 + GREEN];
+            blue[i] = pixels[i * 4 + BLUE];
+            alpha[i] = pixels[i * 4 + 3];
+        }// for
+    }// for
+}// Make_Planar
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split data into tiles, which then hold the current pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Make_Tiled()
+{
+    if (tiles || (!data && !store))
+        return;
+
+    Make_Interleaved();
+
+    tiles = CBufferPool::Acquire(TiledView::Bytes(width, height));
+
+    TiledView   grid(tiles, width, height);
+
+    for (TileIterator it(grid); !it.Done(); it.Next())
+    {
+        ImageView   tile = it.Tile();
+
+        for (int r = 0; r < tile.height; ++r)
+            memcpy(tile.Row(r), data + ((size_t)(it.Y() + r) * width + it.X()) * 4, tile.width * 4);
+    }// for
+}// Make_Tiled
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Acquire a pool buffer for an operation that cannot write over its
+//  input, and return a view of it the size of the selection.
+//
+///////////////////////////////////////////////////////////////////////////////
+ImageView TargaImage::Output_View(unsigned char*& buffer)
+{
+    ImageView   view = View();
+
+    buffer = CBufferPool::Acquire((size_t)view.width * view.height * 4);
+    return ImageView(buffer, view.width, view.height, view.width * 4);
+}// Output_View
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Put the output of Output_View in place and release the buffer.  With
+//  the whole image selected the buffer simply becomes the pixel data;
+//  otherwise only the selected rows are copied back.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Commit_Output(unsigned char*& buffer)
+{
+    if (!selWidth)
+        Swap_Pixels(buffer);
+    else
+    {
+        Make_Unique();
+
+        ImageView   view = View();
+
+        for (int r = 0; r < view.height; ++r)
+            memcpy(view.Row(r), buffer + (size_t)r * view.width * 4, view.width * 4);
+    }// else
+
+    CBufferPool::Release(buffer);
+    buffer = NULL;
+}// Commit_Output
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the pixels under a view placed at (x, y) out of this image,
+//  whether they are in memory or in a store.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Read_Pixels(int x, int y, const ImageView& dest)
+{
+    if (store)
+    {
+        store->Read(x, y, dest);
+        return;
+    }// if
+
+    Make_Interleaved();
+    for (int r = 0; r < dest.height; ++r)
+        memcpy(dest.Row(r), data + ((size_t)(y + r) * width + x) * 4, dest.width * 4);
+}// Read_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run an operation over the selection of an out-of-core image a 64x64
+//  block at a time.  Each block is copied into an image of its own along
+//  with up to radius pixels around it, so the operation sees the same
+//  neighbours it would in the whole image, and only the block is written
+//  back.  Blocks are laid out from the corner of the selection, so an
+//  operation that depends on position sees the coordinates it would in
+//  memory.  With a radius the results go to a new store, so later blocks
+//  still read the old pixels.  pImage, if given, is another image of the
+//  same size whose matching block is passed to the operation.  Several
+//  rows of blocks run at once, so the operation must not depend on the
+//  order pixels are visited in.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Run_Out_Of_Core(const function<bool(TargaImage&, TargaImage*)>& op, int radius, TargaImage* pImage)
+{
+    const int   size = TiledView::TILE_SIZE;
+    int         left = selX;
+    int         top = selY;
+    int         right = selWidth ? selX + selWidth : width;
+    int         bottom = selWidth ? selY + selHeight : height;
+    CTileStore  *output = store;
+    bool        bResult = true;
+
+    // pixels outside the selection must survive in the new store
+    if (radius)
+        output = selWidth ? store->Clone() : CTileStore::Create(width, height);
+    if (!output)
+    {
+        cout << "Unable to create a scratch file for an out-of-core image." << endl;
+        return false;
+    }// if
+
+    // an image in memory must not change layout while bands read from it
+    if (pImage && !pImage->store)
+        pImage->Make_Interleaved();
+
+    // rows of blocks run at once, and a failure in one stops the rest
+    atomic<bool>    bFailed(false);
+    auto            blockRows = [&](int first, int last)
+    {
+        for (int y = top + first * size; !bFailed && y < Min(bottom, top + last * size); y += size)
+        {
+            for (int x = left; !bFailed && x < right; x += size)
+            {
+                int         w = Min(size, right - x);
+                int         h = Min(size, bottom - y);
+                int         x1 = Min(x + w + radius, right);
+                int         y1 = Min(y + h + radius, bottom);
+                int         x0 = Max(left, Min(x - radius, x1 - 2 * radius - 1));
+                int         y0 = Max(top, Min(y - radius, y1 - 2 * radius - 1));
+
+                // border rules need the band to be as big as the kernel, so
+                // the last blocks take more of their neighbours
+                TargaImage  band(Min(right, Max(x1, x0 + 2 * radius + 1)) - x0, Min(bottom, Max(y1, y0 + 2 * radius + 1)) - y0);
+                TargaImage  other;
+
+                Read_Pixels(x0, y0, band.View());
+                if (pImage)
+                {
+                    other = TargaImage(band.width, band.height);
+                    pImage->Read_Pixels(x0, y0, other.View());
+                }// if
+
+                if (op(band, pImage ? &other : NULL))
+                    output->Write(x, y, band.View().Sub(x - x0, y - y0, w, h));
+                else
+                    bFailed = true;
+            }// for
+        }// for
+    };
+
+    CThreadPool::Parallel_Rows((bottom - top + size - 1) / size, blockRows);
+    bResult = !bFailed;
+    if (output != store)
+    {
+        if (bResult)
+            std::swap(store, output);
+        delete output;
+    }// if
+
+    return bResult;
+}// Run_Out_Of_Core
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run an operation over the selection of an out-of-core image in bands
+//  of 64 rows as wide as the selection, top to bottom, for operations that
+//  gather something from the whole image or carry it from row to row.  op
+//  is passed each band and the row of the selection it starts at.  If
+//  bWrite is set the band is written back afterwards.
+//
+///////////////////////////////////////////////////////////////////////////////
+void TargaImage::Run_Bands_Out_Of_Core(const function<void(const ImageView&, int)>& op, bool bWrite)
+{
+    const int   rows = TiledView::TILE_SIZE;
+    const int   w = selWidth ? selWidth : width;
+    const int   h = selWidth ? selHeight : height;
+    TargaImage  band(w, Min(rows, h));
+
+    for (int y = 0; y < h; y += rows)
+    {
+        ImageView   view = band.View().Sub(0, 0, w, Min(rows, h - y));
+
+        Read_Pixels(selX, selY + y, view);
+        op(view, y);
+        if (bWrite)
+            store->Write(selX, selY + y, view);
+    }// for
+}// Run_Bands_Out_Of_Core
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Clear the image to all black.
@@ -1228,7 +3094,14 @@ TargaImage* TargaImage::Reverse_Rows(void)
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::ClearToBlack()
 {
-    memset(data, 0, width * height * 4);
+    if (store)
+    {
+        store->Clear();
+        return;
+    }// if
+
+    Make_Unique();
+    memset(data, 0, (size_t)width * height * 4);
 }// ClearToBlack
 
 
@@ -1239,6 +3112,7 @@ void TargaImage::ClearToBlack()
 //
 ///////////////////////////////////////////////////////////////////////////////
 void TargaImage::Paint_Stroke(const Stroke& s) {
+   Make_Unique();
    int radius_squared = (int)s.radius * (int)s.radius;
    for (int x_off = -((int)s.radius); x_off <= (int)s.radius; x_off++) {
       for (int y_off = -((int)s.radius); y_off <= (int)s.radius; y_off++) {
@@ -1248,19 +3122,19 @@ void TargaImage::Paint_Stroke(const Stroke& s) {
          if ((x_loc >= 0 && x_loc < width && y_loc >= 0 && y_loc < height)) {
             int dist_squared = x_off * x_off + y_off * y_off;
             if (dist_squared <= radius_squared) {
-               data[(y_loc * width + x_loc) * 4 + 0] = s.r;
-               data[(y_loc * width + x_loc) * 4 + 1] = s.g;
-               data[(y_loc * width + x_loc) * 4 + 2] = s.b;
-               data[(y_loc * width + x_loc) * 4 + 3] = s.a;
+               data[((size_t)y_loc * width + x_loc) * 4 + 0] = s.r;
+               data[((size_t)y_loc * width + x_loc) * 4 + 1] = s.g;
+               data[((size_t)y_loc * width + x_loc) * 4 + 2] = s.b;
+               data[((size_t)y_loc * width + x_loc) * 4 + 3] = s.a;
             } else if (dist_squared == radius_squared + 1) {
-               data[(y_loc * width + x_loc) * 4 + 0] = 
-                  (data[(y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
-               data[(y_loc * width + x_loc) * 4 + 1] = 
-                  (data[(y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
-               data[(y_loc * width + x_loc) * 4 + 2] = 
-                  (data[(y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
-               data[(y_loc * width + x_loc) * 4 + 3] = 
-                  (data[(y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
+               data[((size_t)y_loc * width + x_loc) * 4 + 0] = 
+                  (data[((size_t)y_loc * width + x_loc) * 4 + 0] + s.r) / 2;
+               data[((size_t)y_loc * width + x_loc) * 4 + 1] = 
+                  (data[((size_t)y_loc * width + x_loc) * 4 + 1] + s.g) / 2;
+               data[((size_t)y_loc * width + x_loc) * 4 + 2] = 
+                  (data[((size_t)y_loc * width + x_loc) * 4 + 2] + s.b) / 2;
+               data[((size_t)y_loc * width + x_loc) * 4 + 3] = 
+                  (data[((size_t)y_loc * width + x_loc) * 4 + 3] + s.a) / 2;
             }
          }
       }
@@ -15,9 +15,14 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Widget.h>
 #include <stdio.h>
+#include <functional>
+#include <vector>
+#include "ImageView.h"
 
 class Stroke;
 class DistanceImage;
+class CTileStore;
+struct tga_reader;
 
 class TargaImage
 {
@@ -27,11 +32,33 @@ class TargaImage
             TargaImage(int w, int h);
 	    TargaImage(int w, int h, unsigned char *d);
             TargaImage(const TargaImage& image);
+            TargaImage(TargaImage&& image);
 	    ~TargaImage(void);
 
+        TargaImage& operator=(const TargaImage& image);  // share the pixels of another image
+        TargaImage& operator=(TargaImage&& image);  // take over the pixels of another image
+        void Swap(TargaImage& image);               // exchange size and pixels with another image
+        void Make_Unique();                         // copy shared pixels before writing through data
+
+        bool Select(int x, int y, int w, int h);    // restrict later operations to a rectangle.  Returns false if it misses the image
+        void Select_All();                          // operate on the whole image again
+        ImageView View();                           // the pixels operations work on
+
+        unsigned char* Pixels();                    // interleaved RGBA pixels, converting from planes or paging in if needed
+        PlanarView Planes();                        // the selection as R, G, B and A planes.  data is stale until Pixels is called
+        static void Use_Planar_Kernels(bool bUse);  // run operations that have a planar version on planes
+        void Use_Tiles(bool bUse);                  // run this image's operations that have a tiled version on tiles
+        TiledView Tiles();                          // the image as 64x64 tiles.  data is stale until Pixels is called
+
         unsigned char*	To_RGB(void);	            // Convert the image to RGB format,
         bool Save_Image(const char*);               // save the image to a file
-        static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object.  Returns NULL on failure
+        bool Save_Image_RLE(const char*);           // save the image to a run-length encoded file
+        static TargaImage* Load_Image(char*);       // Load a file and return a pointer to a new TargaImage object, out of core if over the memory budget.  Returns NULL on failure
+        unsigned char* Save_Image_Buffer(size_t& size, bool bCompressed = false);  // encode a targa file into memory; free() the result
+        static TargaImage* Load_Image_Buffer(const void*, size_t);                 // decode a targa file held in memory.  Returns NULL on failure
+        static TargaImage* Load_Image_Region(char*, int x, int y, int w, int h);   // load just a rectangle of a file.  Returns NULL on failure
+        static TargaImage* Load_Image_Scaled(char*, int factor);                   // load a file shrunk by factor.  Returns NULL on failure
+        static bool Stream_Image(const char*, const char*, bool (TargaImage::*)(), int bandRows = 64);  // run a point operation over a file a band of rows at a time
 
         bool To_Grayscale();
 
@@ -55,9 +82,11 @@ class TargaImage
         bool Difference(TargaImage* pImage);
 
         bool Filter_Box();
+        bool Filter_Box_N(int radius);
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
+        bool Filter_Gaussian_IIR(double sigma);
         bool Filter_Edge();
         bool Filter_Enhance();
 
@@ -69,6 +98,42 @@ class TargaImage
         bool Rotate(float angleDegrees);
 
     private:
+        // libtarga allocator that hands out this image's pixel buffer
+        static void* Alloc_Pixels(void* user, size_t bytes);
+
+        // make buffer the pixel data and hand back the old pixels in its place
+        void Swap_Pixels(unsigned char*& buffer);
+
+        // the part of another image of the same size under this image's selection
+        ImageView Matching_View(TargaImage* pImage) const;
+
+        // switch the current pixels between data, the planes and the tiles
+        void Make_Interleaved();
+        void Make_Planar();
+        void Make_Tiled();
+
+        // shared body of the neighbourhood filters, and of the separable ones
+        // whose 1D kernel is taps
+        bool Filter_Window(int radius, const std::function<void(const ImageView&, const ImageView&, int, int, int, int)>& filter);
+        bool Filter_Separable(const std::vector<unsigned int>& taps, bool bRound);
+
+        // loading into and saving from a tile store
+        static TargaImage* Load_Out_Of_Core(tga_reader* reader, int w, int h, int rowOrder);
+        bool Save_Out_Of_Core(const char* filename, bool bCompressed);
+
+        // copy the pixels under a view placed at (x, y) out of this image
+        void Read_Pixels(int x, int y, const ImageView& dest);
+
+        // run an operation a block at a time over an out-of-core image
+        bool Run_Out_Of_Core(const std::function<bool(TargaImage&, TargaImage*)>& op, int radius, TargaImage* pImage = NULL);
+
+        // run an operation over full-width bands of an out-of-core image, in order
+        void Run_Bands_Out_Of_Core(const std::function<void(const ImageView&, int)>& op, bool bWrite);
+
+        // scratch output for an out-of-place operation, and putting it in place
+        ImageView Output_View(unsigned char*& buffer);
+        void Commit_Output(unsigned char*& buffer);
+
 	// helper function for format conversion
         void RGBA_To_RGB(unsigned char *rgba, unsigned char *rgb);
 
@@ -86,7 +151,21 @@ class TargaImage
         int		width;	    // width of the image in pixels
         int		height;	    // height of the image in pixels
         unsigned char	*data;	    // pixel data for the image, assumed to be in pre-multiplied RGBA format.
+                                    // Copies share it, so call Make_Unique before writing to it directly.
+                                    // While the image is planar it is stale, and out of core it is NULL, so read it through Pixels.
+
+    private:
+        int             selX;       // selected rectangle, a selWidth of 0 selects the whole image
+        int             selY;
+        int             selWidth;
+        int             selHeight;
+
+        unsigned char   *planes;    // R, G, B and A planes when they hold the current pixels, otherwise NULL
+        unsigned char   *tiles;     // 64x64 tiles when they hold the current pixels, otherwise NULL
+        bool            bTiled;     // operations with a tiled version use it on this image
+        CTileStore      *store;     // the pixels in a scratch file when the image is out of core, otherwise NULL
 
+        static bool     s_bPlanarKernels;   // operations with a planar version use it
 };
 
 class Stroke { // Data structure for holding painterly strokes.
@@ -0,0 +1,210 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.cpp
+//
+//      Implementation of CThreadPool methods.  Workers are started the first
+//  time they are needed and then wait for the next job.  The calling thread
+//  takes bands too, so a pool of n threads starts n - 1 workers.  Band
+//  boundaries depend only on the height and the thread count.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ThreadPool.h"
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+using namespace std;
+
+// constants
+const char      c_sThreadsVariable[]    = "TGA_THREADS";        // environment variable holding the thread count
+
+// the current job and the workers, all guarded by s_lock except that only
+// the thread holding s_jobLock changes the workers
+static mutex                                s_jobLock;              // held by the thread running a job
+static mutex                                s_lock;
+static condition_variable                   s_start;                // a job was posted, or the workers must stop
+static condition_variable                   s_finish;               // the last worker finished a job
+static vector<thread>                       s_workers;
+static int                                  s_threads           = 0;        // 0 until set or first asked for
+static const function<void(int, int)>*      s_pJob              = NULL;
+static int                                  s_height            = 0;
+static int                                  s_bands             = 0;
+static int                                  s_nextBand          = 0;
+static int                                  s_running           = 0;        // workers yet to finish the job
+static unsigned int                         s_jobNumber         = 0;        // changes when a job is posted
+static bool                                 s_bStop             = false;
+static bool                                 s_bStopAtExit       = false;    // Stop_Workers is registered with atexit
+static exception_ptr                        s_error;
+static thread_local bool                    s_bInJob            = false;    // this thread is running a band
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run bands of the current job until none are left.  s_lock must be
+//  held by guard, and is held again on return.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Run_Bands(unique_lock<mutex>& guard)
+{
+    while (s_nextBand < s_bands)
+    {
+        int             band = s_nextBand++;
+        int             first = (int)((long long)band * s_height / s_bands);
+        int             last = (int)((long long)(band + 1) * s_height / s_bands);
+        exception_ptr   error;
+
+        guard.unlock();
+        s_bInJob = true;
+        try
+        {
+            (*s_pJob)(first, last);
+        }// try
+        catch (...)
+        {
+            error = current_exception();
+        }// catch
+        s_bInJob = false;
+        guard.lock();
+
+        if (error && !s_error)
+            s_error = error;
+    }// while
+}// Run_Bands
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Body of a worker thread.  jobNumber is the job posted last before it
+//  started.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Worker(unsigned int jobNumber)
+{
+    unique_lock<mutex>  guard(s_lock);
+
+    for (;;)
+    {
+        s_start.wait(guard, [&] { return s_bStop || s_jobNumber != jobNumber; });
+        if (s_bStop)
+            return;
+
+        jobNumber = s_jobNumber;
+        Run_Bands(guard);
+        if (--s_running == 0)
+            s_finish.notify_one();
+    }// for
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stop and join every worker.  Also run at exit, since a thread still
+//  running then would end the program.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void Stop_Workers()
+{
+    {
+        lock_guard<mutex>   guard(s_lock);
+
+        s_bStop = true;
+    }
+    s_start.notify_all();
+
+    for (size_t i = 0; i < s_workers.size(); ++i)
+        s_workers[i].join();
+    s_workers.clear();
+
+    lock_guard<mutex>   guard(s_lock);
+
+    s_bStop = false;
+}// Stop_Workers
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run rows over bands of [0, height), one per thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::Parallel_Rows(int height, const function<void(int, int)>& rows)
+{
+    if (height <= 0)
+        return;
+
+    // nested calls, and calls from other threads while a job runs, get no
+    // threads of their own
+    unique_lock<mutex>  job(s_jobLock, defer_lock);
+    int                 threads = Min(GetThreads(), height);
+
+    if (threads == 1 || s_bInJob || !job.try_lock())
+    {
+        rows(0, height);
+        return;
+    }// if
+
+    unique_lock<mutex>  guard(s_lock);
+
+    if (!s_bStopAtExit)
+        s_bStopAtExit = atexit(Stop_Workers) == 0;
+    while ((int)s_workers.size() < threads - 1)
+        s_workers.push_back(thread(Worker, s_jobNumber));
+
+    s_pJob = &rows;
+    s_height = height;
+    s_bands = threads;
+    s_nextBand = 0;
+    s_running = (int)s_workers.size();
+    ++s_jobNumber;
+    s_start.notify_all();
+
+    Run_Bands(guard);
+    s_finish.wait(guard, [] { return s_running == 0; });
+
+    exception_ptr   error = s_error;
+
+    s_pJob = NULL;
+    s_error = exception_ptr();
+    guard.unlock();
+
+    if (error)
+        rethrow_exception(error);
+}// Parallel_Rows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set or return the number of threads.  The workers are stopped, and
+//  as many as the new count needs start with the next job.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CThreadPool::SetThreads(int threads)
+{
+    lock_guard<mutex>   job(s_jobLock);
+
+    Stop_Workers();
+
+    lock_guard<mutex>   guard(s_lock);
+
+    s_threads = threads;
+}// SetThreads
+
+int CThreadPool::GetThreads()
+{
+    lock_guard<mutex>   guard(s_lock);
+
+    if (s_threads > 0)
+        return s_threads;
+
+    const char* sThreads = getenv(c_sThreadsVariable);
+    int         threads = sThreads ? atoi(sThreads) : 0;
+
+    if (threads <= 0)
+        threads = (int)thread::hardware_concurrency();
+    s_threads = Max(1, threads);
+    return s_threads;
+}// GetThreads
@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ThreadPool.h
+//
+//      Worker threads shared by the image operations.  An operation hands
+//  Parallel_Rows the number of rows it works on, and each thread runs a
+//  band of them.  Rows must not depend on one another, so the result is
+//  the same for any number of threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_THREAD_POOL
+#define _C_THREAD_POOL
+
+#include <functional>
+
+class CThreadPool
+{
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Call rows(first, last) for bands of rows [first, last) that together
+        //  cover [0, height), one band per thread, and return when all are done.
+        //  A call made while another is running, including from inside rows,
+        //  runs every row on the calling thread.  An exception thrown by rows
+        //  is rethrown here once the other bands finish.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void Parallel_Rows(int height, const std::function<void(int, int)>& rows);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set or return the number of threads, the caller's included.  Until
+        //  it is set, or if it is set to 0, it comes from the TGA_THREADS
+        //  environment variable, or else is one per core.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void SetThreads(int threads);
+        static int GetThreads();
+};// CThreadPool
+
+#endif // _C_THREAD_POOL
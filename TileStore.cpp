@@ -0,0 +1,421 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      TileStore.cpp
+//
+//      Implementation of CTileStore methods.  Tiles of every store share one
+//  least recently used list, so the budget bounds all the out-of-core images
+//  together.  Locked tiles are never unmapped; the budget is only a limit
+//  on the tiles kept mapped for reuse.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "TileStore.h"
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <string>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// constants
+const size_t    c_tileBytes         = TiledView::TILE_BYTES;
+const size_t    c_maxMappedTiles    = 32768;                // stays well under the system's limit on mappings
+
+// mapping state shared by all stores, all guarded by s_lock
+static mutex                                s_lock;
+static list< pair<CTileStore*, int> >       s_lru;                  // mapped, unpinned tiles, most recently used first
+static size_t                               s_mappedTiles       = 0;
+static size_t                               s_budget            = 0;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Return the alignment the offset of a mapping must have.
+//
+///////////////////////////////////////////////////////////////////////////////
+static size_t Granularity()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}// Granularity
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The file is opened by Create.
+//
+///////////////////////////////////////////////////////////////////////////////
+CTileStore::CTileStore(int width, int height) : m_grid(NULL, width, height)
+{
+    STile   tile = { NULL, 0, s_lru.end() };
+
+    m_tiles.assign((size_t)m_grid.tilesAcross * m_grid.tilesDown, tile);
+
+#ifdef _WIN32
+    m_hFile = NULL;
+    m_hMapping = NULL;
+#else
+    m_file = -1;
+#endif
+}// CTileStore
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make a store for a width x height image.
+//
+///////////////////////////////////////////////////////////////////////////////
+CTileStore* CTileStore::Create(int width, int height)
+{
+    CTileStore* pStore = new CTileStore(width, height);
+
+    if (!pStore->Open())
+    {
+        delete pStore;
+        return NULL;
+    }// if
+
+    return pStore;
+}// Create
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make a new store holding the same pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+CTileStore* CTileStore::Clone()
+{
+    CTileStore* pStore = Create(m_grid.width, m_grid.height);
+
+    if (!pStore)
+        throw bad_alloc();
+
+    for (int i = 0; i < (int)m_tiles.size(); ++i)
+    {
+        memcpy(pStore->Lock(i), Lock(i), c_tileBytes);
+        pStore->Unlock(i);
+        Unlock(i);
+    }// for
+
+    return pStore;
+}// Clone
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Unmap every tile and close, and so delete, the file.
+//
+///////////////////////////////////////////////////////////////////////////////
+CTileStore::~CTileStore()
+{
+    {
+        lock_guard<mutex>   guard(s_lock);
+
+        for (int i = 0; i < (int)m_tiles.size(); ++i)
+        {
+            if (!m_tiles[i].pixels)
+                continue;
+            if (!m_tiles[i].pins)
+                s_lru.erase(m_tiles[i].lru);
+            Unmap(i);
+        }// for
+    }
+
+#ifdef _WIN32
+    if (m_hMapping)
+        CloseHandle(m_hMapping);
+    if (m_hFile)
+        CloseHandle(m_hFile);
+#else
+    if (m_file >= 0)
+        close(m_file);
+#endif
+}// ~CTileStore
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Make the scratch file, big enough for every tile.  Return success.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CTileStore::Open()
+{
+    size_t  bytes = m_tiles.size() * c_tileBytes;
+
+#ifdef _WIN32
+    char    sDir[MAX_PATH];
+    char    sPath[MAX_PATH];
+
+    if (!GetTempPathA(MAX_PATH, sDir) || !GetTempFileNameA(sDir, "tga", 0, sPath))
+        return false;
+
+    // the file goes away when the last handle to it is closed
+    HANDLE  hFile = CreateFileA(sPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        DeleteFileA(sPath);
+        return false;
+    }// if
+
+    m_hFile = hFile;
+    m_hMapping = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)bytes >> 32),
+                                    (DWORD)bytes, NULL);
+    return m_hMapping != NULL;
+#else
+    const char* sDir = getenv("TMPDIR");
+    string      path = string(sDir && *sDir ? sDir : "/tmp") + "/tga-tiles-XXXXXX";
+
+    m_file = mkstemp(&path[0]);
+    if (m_file < 0)
+        return false;
+
+    // the file goes away when it is closed
+    unlink(path.c_str());
+    return ftruncate(m_file, (off_t)bytes) == 0;
+#endif
+}// Open
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pin tile i in memory, mapping it if it isn't, and return its pixels.
+//  Unpinned tiles are unmapped first if mapping another would go over the
+//  budget.
+//
+///////////////////////////////////////////////////////////////////////////////
+unsigned char* CTileStore::Lock(int i)
+{
+    lock_guard<mutex>   guard(s_lock);
+    STile&              tile = m_tiles[i];
+
+    if (tile.pixels)
+    {
+        if (tile.pins++ == 0)
+            s_lru.erase(tile.lru);
+        return tile.pixels;
+    }// if
+
+    while (!s_lru.empty() && (s_mappedTiles >= c_maxMappedTiles ||
+                              (s_budget && (s_mappedTiles + 1) * c_tileBytes > s_budget)))
+    {
+        pair<CTileStore*, int>  victim = s_lru.back();
+
+        s_lru.pop_back();
+        victim.first->Unmap(victim.second);
+    }// while
+
+    // mappings start on a multiple of the granularity, which may be
+    // coarser than a tile
+    size_t  offset = (size_t)i * c_tileBytes;
+    size_t  skip = offset % Granularity();
+    void*   pView;
+
+#ifdef _WIN32
+    offset -= skip;
+    pView = MapViewOfFile(m_hMapping, FILE_MAP_WRITE, (DWORD)((unsigned long long)offset >> 32),
+                          (DWORD)offset, skip + c_tileBytes);
+    if (!pView)
+        throw bad_alloc();
+#else
+    pView = mmap(NULL, skip + c_tileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, (off_t)(offset - skip));
+    if (pView == MAP_FAILED)
+        throw bad_alloc();
+#endif
+
+    ++s_mappedTiles;
+    tile.pixels = (unsigned char*)pView + skip;
+    tile.pins = 1;
+    return tile.pixels;
+}// Lock
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Drop a pin on tile i.  The tile stays mapped until it is the least
+//  recently used and room is needed.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::Unlock(int i)
+{
+    lock_guard<mutex>   guard(s_lock);
+    STile&              tile = m_tiles[i];
+
+    if (--tile.pins == 0)
+        tile.lru = s_lru.insert(s_lru.begin(), make_pair(this, i));
+}// Unlock
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Unmap tile i.  s_lock must be held and the tile must not be on the
+//  list.  The pixels stay in the file.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::Unmap(int i)
+{
+    STile&  tile = m_tiles[i];
+    size_t  skip = (size_t)i * c_tileBytes % Granularity();
+
+#ifdef _WIN32
+    UnmapViewOfFile(tile.pixels - skip);
+#else
+    munmap(tile.pixels - skip, skip + c_tileBytes);
+#endif
+
+    --s_mappedTiles;
+    tile.pixels = NULL;
+}// Unmap
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy between a view placed at (x, y) in the image and the tiles under
+//  it, a tile at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::Copy(int x, int y, const ImageView& view, bool bToStore)
+{
+    const int   size = TiledView::TILE_SIZE;
+
+    if (view.width <= 0 || view.height <= 0)
+        return;
+
+    for (int ty = y / size; ty <= (y + view.height - 1) / size; ++ty)
+    {
+        for (int tx = x / size; tx <= (x + view.width - 1) / size; ++tx)
+        {
+            int             i = ty * m_grid.tilesAcross + tx;
+            unsigned char   *pixels = Lock(i);
+
+            // the part of the view over this tile
+            int left = Max(x, tx * size);
+            int right = Min(x + view.width, (tx + 1) * size);
+            int top = Max(y, ty * size);
+            int bottom = Min(y + view.height, (ty + 1) * size);
+
+            for (int r = top; r < bottom; ++r)
+            {
+                unsigned char   *tileRow = pixels + ((r - ty * size) * size + left - tx * size) * 4;
+                unsigned char   *viewRow = view.Row(r - y) + (left - x) * 4;
+
+                if (bToStore)
+                    memcpy(tileRow, viewRow, (right - left) * 4);
+                else
+                    memcpy(viewRow, tileRow, (right - left) * 4);
+            }// for
+
+            Unlock(i);
+        }// for
+    }// for
+}// Copy
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the pixels under a view placed at (x, y) out of the store.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::Read(int x, int y, const ImageView& dest)
+{
+    Copy(x, y, dest, false);
+}// Read
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Copy the pixels of a view into the store at (x, y).
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::Write(int x, int y, const ImageView& source)
+{
+    Copy(x, y, source, true);
+}// Write
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set every pixel to zero.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::Clear()
+{
+    for (int i = 0; i < (int)m_tiles.size(); ++i)
+    {
+        memset(Lock(i), 0, c_tileBytes);
+        Unlock(i);
+    }// for
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set or return the memory budget for mapped tiles.
+//
+///////////////////////////////////////////////////////////////////////////////
+void CTileStore::SetBudget(size_t bytes)
+{
+    lock_guard<mutex>   guard(s_lock);
+
+    s_budget = bytes;
+}// SetBudget
+
+size_t CTileStore::GetBudget()
+{
+    lock_guard<mutex>   guard(s_lock);
+
+    return s_budget;
+}// GetBudget
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Read a size in megabytes, or with a K, M or G suffix and an optional
+//  B after it.  Return false if the string is not one.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool CTileStore::ParseSize(const char* sSize, size_t& bytes)
+{
+    char*   sEnd;
+    double  size;
+    double  unit = 1024.0 * 1024.0;
+
+    if (!sSize)
+        return false;
+
+    size = strtod(sSize, &sEnd);
+    if (sEnd == sSize || size < 0)
+        return false;
+
+    switch (toupper(*sEnd))
+    {
+        case 'K':   unit = 1024.0;                      ++sEnd;     break;
+        case 'M':   unit = 1024.0 * 1024.0;             ++sEnd;     break;
+        case 'G':   unit = 1024.0 * 1024.0 * 1024.0;    ++sEnd;     break;
+    }// switch
+
+    if (toupper(*sEnd) == 'B')
+        ++sEnd;
+    if (*sEnd)
+        return false;
+
+    bytes = (size_t)(size * unit);
+    return true;
+}// ParseSize
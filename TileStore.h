@@ -0,0 +1,116 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      TileStore.h
+//
+//      Pixels of an image too big to hold in memory, kept in a scratch file
+//  laid out as 64x64 RGBA tiles in the same order as TiledView.  A tile is
+//  mapped into memory while it is locked and stays mapped afterwards until
+//  the tiles mapped by every store together would go over the memory
+//  budget, when the least recently used ones are unmapped.  The scratch
+//  file is deleted when the store is.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _C_TILE_STORE
+#define _C_TILE_STORE
+
+#include "ImageView.h"
+#include <vector>
+#include <list>
+
+class CTileStore
+{
+    // methods
+    public:
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Make a store for a width x height image in a new scratch file in
+        //  TMPDIR, /tmp, or on Windows the temporary directory.  The pixels start
+        //  out black.  Returns NULL if the file can't be made.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static CTileStore* Create(int width, int height);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Make a new store holding the same pixels.  Throws std::bad_alloc if
+        //  the scratch file can't be made.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        CTileStore* Clone();
+
+        ~CTileStore();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Copy the pixels under a view placed at (x, y) in the image out of the
+        //  store, or into it.  Tiles are mapped as needed; throws std::bad_alloc
+        //  if one can't be.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Read(int x, int y, const ImageView& dest);
+        void Write(int x, int y, const ImageView& source);
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set every pixel to zero.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        void Clear();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Set the most memory that tiles of all stores may have mapped at once;
+        //  0, the default, means no limit.  Images whose pixels would take more
+        //  than the budget are loaded into a store instead of memory.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static void SetBudget(size_t bytes);
+        static size_t GetBudget();
+
+        ///////////////////////////////////////////////////////////////////////////////
+        //
+        //      Read a size in megabytes, or with a K, M or G suffix.  Returns false
+        //  if the string is not one.
+        //
+        ///////////////////////////////////////////////////////////////////////////////
+        static bool ParseSize(const char* sSize, size_t& bytes);
+
+    private:
+        CTileStore(int width, int height);
+
+        bool Open();
+
+        // pin tile i in memory and return its pixels, or let it go again
+        unsigned char* Lock(int i);
+        void Unlock(int i);
+
+        // unmap tile i of this store
+        void Unmap(int i);
+
+        // copy between a view at (x, y) and the tiles under it
+        void Copy(int x, int y, const ImageView& view, bool bToStore);
+
+    // types
+    private:
+        struct STile
+        {
+            unsigned char   *pixels;    // the mapped tile, NULL while unmapped
+            int             pins;       // locks held on it
+            std::list< std::pair<CTileStore*, int> >::iterator  lru;   // place among the unpinned tiles while mapped and unpinned
+        };// STile
+
+    // members
+    private:
+        TiledView           m_grid;     // size and tile layout; its data is not used
+        std::vector<STile>  m_tiles;    // mapping state of each tile
+
+#ifdef _WIN32
+        void                *m_hFile;   // scratch file
+        void                *m_hMapping;
+#else
+        int                 m_file;     // scratch file, already unlinked
+#endif
+};// CTileStore
+
+#endif // _C_TILE_STORE
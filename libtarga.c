@@ -46,8 +46,52 @@
   09-16-2005
 */
 
+/* 64-bit file offsets where off_t would otherwise be 32 bits */
+#if !defined(_WIN32) && !defined(_FILE_OFFSET_BITS)
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
+
+/* file offsets past 2GB; long is 32 bits on Win64 */
+#if defined(_WIN32)
+typedef __int64 tga_off;
+#define tga_fseek _fseeki64
+#define tga_ftell _ftelli64
+#else
+#include <sys/types.h>
+typedef off_t tga_off;
+#define tga_fseek fseeko
+#define tga_ftell ftello
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TGA_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define TGA_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* the premultiply tables are built once, whichever thread gets there first */
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#if defined(_MSC_VER)
+#define TGA_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define TGA_THREAD_LOCAL __thread
+#else
+#define TGA_THREAD_LOCAL
+#endif
 
 #include "libtarga.h"
 
@@ -97,23 +141,332 @@
 #define TGA_ERR_READ_FAILS              (9)
 #define TGA_ERR_BAD_IMAGE_TYPE          (10)
 #define TGA_ERR_BAD_DIMENSIONS          (11)
+#define TGA_ERR_NO_MEMORY               (12)
+#define TGA_ERR_WRITE_FAILS             (13)
+#define TGA_ERR_OUTSIDE_IMAGE           (14)
+
 
+#define TGA_STAGE_BYTES          (1 << 20)
+#define TGA_STREAM_BYTES         (1 << 18)
 
 
-static uint32 TargaError;
+
+/* the last error of the calls that don't take an error argument; one per
+   thread, so those calls are as safe to use concurrently as the _r ones */
+static TGA_THREAD_LOCAL int TargaError;
+
+
+/* premultiplied channel values, indexed [alpha][channel], and the
+   straight values the writers produce from them.  written once, then
+   only read. */
+static ubyte tga_premul_table[256][256];
+static ubyte tga_unpremul_table[256][256];
+
+#if defined(_WIN32)
+static INIT_ONCE      tga_tables_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t tga_tables_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/* the contents of an open file, either mapped or read in one call */
+typedef struct {
+    const ubyte * data;         // first byte of the file
+    size_t        len;          // number of bytes available at data
+    void *        base;         // start of the mapping or buffer
+    size_t        base_len;     // length of the mapping
+    int           mapped;       // non-zero if base came from mmap
+} tga_payload;
+
+
+/* read position in a targa held in memory.  like stdio, reads past the
+   end fail and the position may be left beyond the end by a skip. */
+typedef struct {
+    const ubyte * data;
+    size_t        len;
+    size_t        pos;
+} tga_cursor;
+
+
+/* output staged in large blocks so a file is a handful of writes */
+typedef struct {
+    FILE *        file;
+    ubyte *       buf;
+    uint32        len;          // bytes waiting in buf
+    uint32        cap;          // size of buf
+    int           failed;       // non-zero once a write has failed
+} tga_stage;
+
+
+/* a targa being decoded a band of scanlines at a time */
+struct tga_reader {
+    FILE *        file;
+    uint32        width;
+    uint32        height;
+    uint32        format;
+    ubyte         bytes_per_pix;
+    int           has_alpha;
+    int           rle;
+    int           mirrored;     // non-zero if rows are stored right to left
+    uint32        row;          // stored scanline decoded next
+    int           off_row;      // non-zero if the file isn't at the start of row
+
+    ubyte *       buf;          // bytes read ahead from the file
+    size_t        pos;          // next unread byte in buf
+    size_t        len;          // bytes held in buf
+    size_t        cap;          // size of buf
+    int           eof;          // non-zero once the file has run out
+    int           failed;       // non-zero once a seek has failed
+
+    tga_off       data_start;   // file offset of the first pixel
+
+    uint32        packet_left;  // pixels left in the current RLE packet
+    int           packet_run;   // non-zero if that packet is a run
+    int           run_state;    // 1 if run_pixel is unconverted, 2 once color holds it
+    ubyte         run_pixel[4]; // stored pixel of the current run
+    ubyte         color[4];     // converted colour of the current run
+    ubyte         missing[4];   // what a pixel past the end decodes to
+};
+
+
+/* a targa being encoded a band of scanlines at a time */
+struct tga_writer {
+    tga_stage     stage;
+    uint32        width;
+    uint32        height;
+    uint32        format;
+    int           rle;
+    uint32        rows_done;    // scanlines written so far
+    ubyte *       linebuf;      // converted pixels of the row being encoded
+};
 
 
 static int16 ttohs( int16 val );
 static int16 htots( int16 val );
 static int32 ttohl( int32 val );
-static int32 htotl( int32 val );
 
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry );
+static uint32 tga_get_pixel( tga_cursor * src, ubyte bytes_per_pix, 
+                            ubyte * colormap, ubyte cmap_bytes_entry, uint32 cmap_length );
+static int tga_read_byte( tga_cursor * src, ubyte * out );
 static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out );
 static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
                                    uint32 w, uint32 h, uint32 pixel, uint32 format );
+static ubyte tga_premultiply( ubyte c, ubyte a );
+static ubyte tga_unpremultiply( ubyte c, ubyte a );
+static void tga_fill_tables( void );
+static void tga_build_tables( void );
+
+static uint32 tga_make_header( ubyte * hdr, int width, int height, 
+                               ubyte img_type, ubyte pixdepth, ubyte img_desc );
+static void tga_pack_row( const ubyte * src, ubyte * dst, uint32 count, uint32 format );
+static uint32 tga_rle_encode_row( const ubyte * src, uint32 width, uint32 format, ubyte * out );
+static int  tga_stage_open( tga_stage * stage, FILE * tga, uint32 min_bytes );
+static void tga_stage_flush( tga_stage * stage );
+static int  tga_stage_close( tga_stage * stage, int * error );
+
+static tga_reader * tga_open_reader( const char * filename, int * width, int * height, unsigned int format,
+                                     int * row_order, int * error );
+static void tga_add_row( uint32 * sums, const ubyte * src, size_t count );
+static int  tga_image_bytes( uint32 width, uint32 height, uint32 format, size_t * bytes );
+static void tga_shrink_sums( uint32 * sums, uint32 width, uint32 count, uint32 factor, uint32 format, 
+                             ubyte * dst );
+static size_t tga_reader_fill( tga_reader * reader, size_t want );
+static void tga_reader_raw( tga_reader * reader, ubyte * dst, uint32 count );
+static void tga_reader_pixels( tga_reader * reader, ubyte * dst, uint32 count );
+static void tga_reader_row( tga_reader * reader, ubyte * dst, uint32 x, uint32 count );
+static void tga_reader_skip_rows( tga_reader * reader, uint32 rows );
+static void tga_reader_seek( tga_reader * reader, uint32 row, uint32 x );
+static void tga_parse_header( const ubyte * hdr, tga_info * info );
+
+static int  tga_map_payload( FILE * tga, tga_payload * payload );
+static void tga_unmap_payload( tga_payload * payload );
+static void tga_convert_row( const ubyte * src, ubyte * dst, uint32 count, 
+                             ubyte bytes_per_pix, int has_alpha, uint32 format );
+static void tga_load_unc_truecolor( const ubyte * src, size_t len, ubyte * dat, uint32 w, uint32 h, 
+                                    ubyte bytes_per_pix, int has_alpha, ubyte img_desc, uint32 format );
+static void tga_load_rle_truecolor( const ubyte * src, size_t len, ubyte * dat, uint32 w, uint32 h, 
+                                    ubyte bytes_per_pix, int has_alpha, ubyte img_desc, uint32 format );
+static uint32 tga_make_header( ubyte * hdr, int width, int height, 
+                               ubyte img_type, ubyte pixdepth, ubyte img_desc ) {
+
+    // fill in a truecolor header followed by our image id; returns the
+    // number of bytes used.
+
+    static const char id[] = "written with libtarga";
+    const ubyte idlen = 21;
+
+    memset( hdr, 0, HDR_LENGTH );
+
+    hdr[HDR_IDLEN]                   = idlen;
+    hdr[HDR_IMAGE_TYPE]              = img_type;
+    hdr[HDR_IMG_SPEC_WIDTH]          = (ubyte)(width & 0xFF);
+    hdr[HDR_IMG_SPEC_WIDTH + 1]      = (ubyte)((width >> 8) & 0xFF);
+    hdr[HDR_IMG_SPEC_HEIGHT]         = (ubyte)(height & 0xFF);
+    hdr[HDR_IMG_SPEC_HEIGHT + 1]     = (ubyte)((height >> 8) & 0xFF);
+    hdr[HDR_IMG_SPEC_PIX_DEPTH]      = pixdepth;
+    hdr[HDR_IMG_SPEC_IMG_DESC]       = img_desc;
+
+    memcpy( hdr + HDR_LENGTH, id, idlen );
+
+    return( HDR_LENGTH + idlen );
+
+}
+
+
+
+
+static void tga_pack_row( const ubyte * src, ubyte * dst, uint32 count, uint32 format ) {
+
+    // convert premultiplied RGB(A) to the BGR(A) bytes that go in the
+    // file, un-premultiplying 32-bit pixels on the way.
+
+    uint32 i;
+    const ubyte * row;
+
+    if( format == TGA_TRUECOLOR_24 ) {
+
+        for( i = 0; i < count; i++, src += 3, dst += 3 ) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+        }
+        return;
+
+    }
+
+    tga_build_tables();
+
+    for( i = 0; i < count; i++, src += 4, dst += 4 ) {
+        row = tga_unpremul_table[src[3]];
+        dst[0] = row[src[2]];
+        dst[1] = row[src[1]];
+        dst[2] = row[src[0]];
+        dst[3] = tga_unpremul_table[255][src[3]];
+    }
+
+}
+
+
+
+
+static uint32 tga_rle_encode_row( const ubyte * src, uint32 width, uint32 format, ubyte * out ) {
+
+    // encode one row of file-order pixels.  two or more equal pixels make
+    // a run packet, everything else goes in raw packets, which stop just
+    // before the next run.  returns the number of bytes written.
+
+    uint32 x = 0;
+    uint32 n;
+    ubyte * start = out;
+
+    while( x < width ) {
+
+        n = 1;
+        while( x + n < width && n < 128 && 
+               !memcmp( src + (x + n) * format, src + x * format, format ) ) {
+            n++;
+        }
+
+        if( n > 1 ) {
+
+            *out++ = (ubyte)(0x80 | (n - 1));
+            memcpy( out, src + x * format, format );
+            out += format;
+
+        } else {
+
+            while( x + n < width && n < 128 &&
+                   !(x + n + 1 < width && 
+                     !memcmp( src + (x + n) * format, src + (x + n + 1) * format, format )) ) {
+                n++;
+            }
+
+            *out++ = (ubyte)(n - 1);
+            memcpy( out, src + x * format, n * format );
+            out += n * format;
+
+        }
+
+        x += n;
+
+    }
+
+    return( (uint32)(out - start) );
+
+}
+
+
+
+
+static int tga_stage_open( tga_stage * stage, FILE * tga, uint32 min_bytes ) {
+
+    // the header, id and at least one row have to fit in the buffer.
+
+    stage->file = tga;
+    stage->len = 0;
+    stage->failed = 0;
+    stage->cap = TGA_STAGE_BYTES;
+
+    if( stage->cap < min_bytes + HDR_LENGTH + 255 ) {
+        stage->cap = min_bytes + HDR_LENGTH + 255;
+    }
+
+    stage->buf = (ubyte *)malloc( stage->cap );
+    if( stage->buf == NULL ) {
+        return( 0 );
+    }
+
+    // every write is already a large block, so skip stdio's copy.
+    setvbuf( tga, NULL, _IONBF, 0 );
+
+    return( 1 );
+
+}
+
+
+
+
+static void tga_stage_flush( tga_stage * stage ) {
+
+    if( stage->len && fwrite( stage->buf, 1, stage->len, stage->file ) != stage->len ) {
+        stage->failed = 1;
+    }
+
+    stage->len = 0;
+
+}
+
+
+
+
+static int tga_stage_close( tga_stage * stage, int * error ) {
+
+    // flush what's left and close the file; returns 1 if everything
+    // made it to disk.
+
+    tga_stage_flush( stage );
+
+    if( fclose( stage->file ) != 0 ) {
+        stage->failed = 1;
+    }
+
+    free( stage->buf );
+    stage->buf = NULL;
+
+    if( stage->failed ) {
+        *error = TGA_ERR_WRITE_FAILS;
+        return( 0 );
+    }
+
+    return( 1 );
+
+}
+
+
+
+
+static void tga_fill_span( ubyte * dst, uint32 count, const ubyte * pixel, uint32 format );
 
 
 
@@ -164,6 +517,15 @@ const char * tga_error_string( int error_code ) {
     case TGA_ERR_BAD_DIMENSIONS:
         return( "image has size 0 width or height (or both)" );
 
+    case TGA_ERR_NO_MEMORY:
+        return( "out of memory" );
+
+    case TGA_ERR_WRITE_FAILS:
+        return( "cannot write to file" );
+
+    case TGA_ERR_OUTSIDE_IMAGE:
+        return( "region lies partly or wholly outside the image" );
+
     default:
         return( "unknown error" );
 
@@ -179,13 +541,17 @@ const char * tga_error_string( int error_code ) {
 /* creates a targa image of the desired format */
 void * tga_create( int width, int height, unsigned int format ) {
 
+    size_t bytes;
+
     switch( format ) {
         
     case TGA_TRUECOLOR_32:
-        return( (void *)malloc( width * height * 4 ) );
-        
     case TGA_TRUECOLOR_24:
-        return( (void *)malloc( width * height * 3 ) );
+        if( width < 0 || height < 0 || !tga_image_bytes( width, height, format, &bytes ) ) {
+            TargaError = TGA_ERR_NO_MEMORY;
+            return( NULL );
+        }
+        return( (void *)malloc( bytes ) );
         
     default:
         TargaError = TGA_ERR_BAD_FORMAT;
@@ -202,6 +568,94 @@ void * tga_create( int width, int height, unsigned int format ) {
 /* loads and converts a targa from disk */
 void * tga_load( const char * filename, 
                 int * width, int * height, unsigned int format ) {
+
+    return( tga_load_ex( filename, width, height, format, TGA_BOTTOM_UP, NULL, NULL ) );
+
+}
+
+
+
+/* loads and converts a targa from disk into memory from the given allocator */
+void * tga_load_ex( const char * filename, int * width, int * height, unsigned int format,
+                    int row_order, tga_alloc_func alloc, void * user ) {
+
+    return( tga_load_r( filename, width, height, format, row_order, alloc, user, &TargaError ) );
+
+}
+
+
+
+
+/* tga_load_ex, reporting errors through error */
+void * tga_load_r( const char * filename, int * width, int * height, unsigned int format,
+                   int row_order, tga_alloc_func alloc, void * user, int * error ) {
+
+    FILE * targafile;
+    tga_payload payload;
+    void * image_data;
+
+    switch( format ) {
+
+    case TGA_TRUECOLOR_24:
+    case TGA_TRUECOLOR_32:
+        break;
+
+    default:
+        *error = TGA_ERR_BAD_FORMAT;
+        return( NULL );
+
+    }
+
+    /* open binary image file */
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
+
+    /* get the whole file into memory; a mapping outlives the FILE */
+    if( !tga_map_payload( targafile, &payload ) ) {
+        fclose( targafile );
+        *error = TGA_ERR_READ_FAILS;
+        return( NULL );
+    }
+
+    fclose( targafile );
+
+    image_data = tga_decode_memory_r( payload.data, payload.len, width, height, format, 
+                                      row_order, alloc, user, error );
+
+    tga_unmap_payload( &payload );
+
+    return( image_data );
+
+}
+
+
+
+/* decodes a targa held in memory */
+void * tga_decode_memory( const void * buf, size_t len, int * width, int * height, unsigned int format ) {
+
+    return( tga_decode_memory_ex( buf, len, width, height, format, TGA_BOTTOM_UP, NULL, NULL ) );
+
+}
+
+
+
+/* decodes a targa held in memory into memory from the given allocator */
+void * tga_decode_memory_ex( const void * buf, size_t len, int * width, int * height, unsigned int format,
+                             int row_order, tga_alloc_func alloc, void * user ) {
+
+    return( tga_decode_memory_r( buf, len, width, height, format, row_order, alloc, user, &TargaError ) );
+
+}
+
+
+
+
+/* tga_decode_memory_ex, reporting errors through error */
+void * tga_decode_memory_r( const void * buf, size_t len, int * width, int * height, unsigned int format,
+                            int row_order, tga_alloc_func alloc, void * user, int * error ) {
     
     ubyte  idlen;               // length of the image_id string below.
     ubyte  cmap_type;           // paletted image <=> cmap_type
@@ -216,9 +670,9 @@ void * tga_load( const char * filename,
     ubyte  img_spec_pix_depth;  // the depth of a pixel in the image.
     ubyte  img_spec_img_desc;   // the image descriptor.
 
-    FILE * targafile;
+    tga_cursor src;
 
-    ubyte * tga_hdr = NULL;
+    ubyte tga_hdr[HDR_LENGTH];
 
     ubyte * colormap = NULL;
 
@@ -243,16 +697,18 @@ void * tga_load( const char * filename,
     uint32 j = 0;
 
     ubyte * image_data = 0;
-    uint32 img_dat_len = 0;
+    size_t img_dat_len = 0;
 
     ubyte bytes_per_pix = 0;
 
     ubyte true_bits_per_pixel = 0;
 
-    uint32 bytes_total = 0;
+    size_t bytes_total = 0;
 
     ubyte packet_header = 0;
     ubyte repcount = 0;
+
+    ubyte pixel_desc = 0;
     
 
     switch( format ) {
@@ -262,30 +718,26 @@ void * tga_load( const char * filename,
         break;
 
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
+        *error = TGA_ERR_BAD_FORMAT;
         return( NULL );
 
     }
 
-    
-    /* open binary image file */
-    targafile = fopen( filename, "rb" );
-    if( targafile == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
-        return( NULL );
-    }
 
+    src.data = (const ubyte *)buf;
+    src.len = len;
+    src.pos = 0;
 
-    /* allocate memory for the header */
-    tga_hdr = (ubyte *)malloc( HDR_LENGTH );
 
     /* read the header in. */
-    if( fread( (void *)tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
-        free( tga_hdr );
-        TargaError = TGA_ERR_BAD_HEADER;
+    if( buf == NULL || len < HDR_LENGTH ) {
+        *error = TGA_ERR_BAD_HEADER;
         return( NULL );
     }
 
+    memcpy( tga_hdr, src.data, HDR_LENGTH );
+    src.pos = HDR_LENGTH;
+
     
     /* byte order is important here. */
     idlen              = (ubyte)tga_hdr[HDR_IDLEN];
@@ -304,13 +756,11 @@ void * tga_load( const char * filename,
     img_spec_pix_depth = (ubyte)tga_hdr[HDR_IMG_SPEC_PIX_DEPTH];
     img_spec_img_desc  = (ubyte)tga_hdr[HDR_IMG_SPEC_IMG_DESC];
 
-    free( tga_hdr );
-
 
     num_pixels = img_spec_width * img_spec_height;
 
     if( num_pixels == 0 ) {
-        TargaError = TGA_ERR_BAD_DIMENSIONS;
+        *error = TGA_ERR_BAD_DIMENSIONS;
         return( NULL );
     }
 
@@ -319,17 +769,12 @@ void * tga_load( const char * filename,
 
     
     /* seek past the image id, if there is one */
-    if( idlen ) {
-        if( fseek( targafile, idlen, SEEK_CUR ) ) {
-            TargaError = TGA_ERR_UNEXPECTED_EOF;
-            return( NULL );
-        }
-    }
+    src.pos += idlen;
 
 
     /* if this is a 'nodata' image, just jump out. */
     if( image_type == TGA_IMG_NODATA ) {
-        TargaError = TGA_ERR_NODATA_IMAGE;
+        *error = TGA_ERR_NODATA_IMAGE;
         return( NULL );
     }
 
@@ -355,7 +800,7 @@ void * tga_load( const char * filename,
             
         case TGA_IMG_UNC_GRAYSCALE:
         case TGA_IMG_RLE_GRAYSCALE:
-            TargaError = TGA_ERR_COLORMAP_FOR_GRAY;
+            *error = TGA_ERR_COLORMAP_FOR_GRAY;
             return( NULL );
         }
         
@@ -364,7 +809,7 @@ void * tga_load( const char * filename,
             cmap_entry_size == 16 ||
             cmap_entry_size == 24 ||
             cmap_entry_size == 32) ) {
-            TargaError = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
+            *error = TGA_ERR_BAD_COLORMAP_ENTRY_SIZE;
             return( NULL );
         }
         
@@ -384,14 +829,14 @@ void * tga_load( const char * filename,
             
             /* seek ahead to first entry used */
             if( cmap_first != 0 ) {
-                fseek( targafile, cmap_first * cmap_bytes_entry, SEEK_CUR );
+                src.pos += cmap_first * cmap_bytes_entry;
             }
             
             tmp_int32 = 0;
             for( j = 0; j < cmap_bytes_entry; j++ ) {
-                if( !fread( &tmp_byte, 1, 1, targafile ) ) {
+                if( !tga_read_byte( &src, &tmp_byte ) ) {
                     free( colormap );
-                    TargaError = TGA_ERR_BAD_COLORMAP;
+                    *error = TGA_ERR_BAD_COLORMAP;
                     return( NULL );
                 }
                 tmp_int32 += tmp_byte << (j * 8);
@@ -423,12 +868,40 @@ void * tga_load( const char * filename,
     }
 
 
+    switch( image_type ) {
+
+    case TGA_IMG_UNC_TRUECOLOR:
+    case TGA_IMG_UNC_GRAYSCALE:
+    case TGA_IMG_UNC_PALETTED:
+    case TGA_IMG_RLE_TRUECOLOR:
+    case TGA_IMG_RLE_GRAYSCALE:
+    case TGA_IMG_RLE_PALETTED:
+        break;
+
+    default:
+        free( colormap );
+        *error = TGA_ERR_BAD_IMAGE_TYPE;
+        return( NULL );
+
+    }
+
+
     /* compute how many bytes of storage we need for the image */
-    bytes_total = img_spec_width * img_spec_height * format;
+    image_data = NULL;
+    if( tga_image_bytes( img_spec_width, img_spec_height, format, &bytes_total ) ) {
+        image_data = (ubyte *)(alloc ? alloc( user, bytes_total ) : malloc( bytes_total ));
+    }
+    if( image_data == NULL ) {
+        free( colormap );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
 
-    image_data = (ubyte *)malloc( bytes_total );
+    /* flipping the vertical origin bit makes every decoder below write
+       the rows in the caller's order */
+    pixel_desc = (row_order == TGA_TOP_DOWN) ? (img_spec_img_desc ^ 0x20) : img_spec_img_desc;
 
-    img_dat_len = img_spec_width * img_spec_height * bytes_per_pix;
+    img_dat_len = (size_t)img_spec_width * img_spec_height * bytes_per_pix;
 
     // compute the true number of bits per pixel
     true_bits_per_pixel = cmap_type ? cmap_entry_size : img_spec_pix_depth;
@@ -439,16 +912,28 @@ void * tga_load( const char * filename,
     case TGA_IMG_UNC_GRAYSCALE:
     case TGA_IMG_UNC_PALETTED:
 
+        /* plain 24/32-bit data is converted a scanline at a time */
+        if( image_type == TGA_IMG_UNC_TRUECOLOR && colormap == NULL &&
+            (img_spec_pix_depth == 24 || img_spec_pix_depth == 32) &&
+            !(img_spec_img_desc & 0x10) ) {
+
+            tga_load_unc_truecolor( src.data + src.pos, src.pos < src.len ? src.len - src.pos : 0,
+                                    image_data, img_spec_width, img_spec_height,
+                                    bytes_per_pix, img_spec_pix_depth == 32 && alphabits,
+                                    pixel_desc, format );
+            break;
+        }
+
         /* FIXME: support grayscale */
 
         for( i = 0; i < num_pixels; i++ ) {
 
             // get the color value.
-            tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
+            tmp_col = tga_get_pixel( &src, bytes_per_pix, colormap, cmap_bytes_entry, cmap_length );
             tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
             
             // now write the data out.
-            tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
+            tga_write_pixel_to_mem( image_data, pixel_desc, 
                 i, img_spec_width, img_spec_height, tmp_col, format );
 
         }
@@ -462,10 +947,22 @@ void * tga_load( const char * filename,
 
         // FIXME: handle grayscale..
 
+        /* 24/32-bit runs are filled and raw packets converted as spans */
+        if( image_type == TGA_IMG_RLE_TRUECOLOR && colormap == NULL &&
+            (img_spec_pix_depth == 24 || img_spec_pix_depth == 32) &&
+            !(img_spec_img_desc & 0x10) ) {
+
+            tga_load_rle_truecolor( src.data + src.pos, src.pos < src.len ? src.len - src.pos : 0,
+                                    image_data, img_spec_width, img_spec_height,
+                                    bytes_per_pix, img_spec_pix_depth == 32 && alphabits,
+                                    pixel_desc, format );
+            break;
+        }
+
         for( i = 0; i < num_pixels; ) {
 
             /* a bit of work to do to read the data.. */
-            if( fread( &packet_header, 1, 1, targafile ) < 1 ) {
+            if( !tga_read_byte( &src, &packet_header ) ) {
                 // well, just let them fill the rest with null pixels then...
                 packet_header = 1;
             }
@@ -473,14 +970,17 @@ void * tga_load( const char * filename,
             if( packet_header & 0x80 ) {
                 /* run length packet */
 
-                tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
+                tmp_col = tga_get_pixel( &src, bytes_per_pix, colormap, cmap_bytes_entry, cmap_length );
                 tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
                 
                 repcount = (packet_header & 0x7F) + 1;
+                if( repcount > num_pixels - i ) {
+                    repcount = (ubyte)(num_pixels - i);
+                }
                 
                 /* write all the data out */
                 for( j = 0; j < repcount; j++ ) {
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
+                    tga_write_pixel_to_mem( image_data, pixel_desc, 
                         i + j, img_spec_width, img_spec_height, tmp_col, format );
                 }
 
@@ -491,13 +991,16 @@ void * tga_load( const char * filename,
                 /* get pixel from file */
                 
                 repcount = (packet_header & 0x7F) + 1;
+                if( repcount > num_pixels - i ) {
+                    repcount = (ubyte)(num_pixels - i);
+                }
                 
                 for( j = 0; j < repcount; j++ ) {
                     
-                    tmp_col = tga_get_pixel( targafile, bytes_per_pix, colormap, cmap_bytes_entry );
+                    tmp_col = tga_get_pixel( &src, bytes_per_pix, colormap, cmap_bytes_entry, cmap_length );
                     tmp_col = tga_convert_color( tmp_col, true_bits_per_pixel, alphabits, format );
                     
-                    tga_write_pixel_to_mem( image_data, img_spec_img_desc, 
+                    tga_write_pixel_to_mem( image_data, pixel_desc, 
                         i + j, img_spec_width, img_spec_height, tmp_col, format );
 
                 }
@@ -511,14 +1014,9 @@ void * tga_load( const char * filename,
         break;
     
 
-    default:
-
-        TargaError = TGA_ERR_BAD_IMAGE_TYPE;
-        return( NULL );
-
     }
 
-    fclose( targafile );
+    free( colormap );
 
     *width  = img_spec_width;
     *height = img_spec_height;
@@ -533,24 +1031,35 @@ void * tga_load( const char * filename,
 
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
 
-    FILE * tga;
+    return( tga_write_raw_ex( file, width, height, dat, format, TGA_BOTTOM_UP ) );
+
+}
+
+
+
+
+int tga_write_raw_ex( const char * file, int width, int height, const unsigned char * dat, 
+                      unsigned int format, int row_order ) {
+
+    return( tga_write_raw_r( file, width, height, dat, format, row_order, &TargaError ) );
+
+}
+
+
+
 
-    uint32 i, j;
+/* tga_write_raw_ex, reporting errors through error */
+int tga_write_raw_r( const char * file, int width, int height, const unsigned char * dat, 
+                     unsigned int format, int row_order, int * error ) {
 
-    uint32 size = width * height;
+    FILE * tga;
+    tga_stage stage;
+
+    uint32 row;
+    uint32 row_bytes = width * format;
 
-    float red, green, blue, alpha;
+    const unsigned char * line;
 
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 2;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
     ubyte img_desc;
     
     
@@ -565,7 +1074,7 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
         break;
 
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
+        *error = TGA_ERR_BAD_FORMAT;
         return( 0 );
         break;
 
@@ -574,637 +1083,1824 @@ int tga_write_raw( const char * file, int width, int height, unsigned char * dat
     tga = fopen( file, "wb" );
 
     if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
+        *error = TGA_ERR_OPEN_FAILS;
         return( 0 );
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+    if( !tga_stage_open( &stage, tga, row_bytes ) ) {
+        fclose( tga );
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
+    }
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
+    // header and image id go out with the first block of pixels.
+    stage.len = tga_make_header( stage.buf, width, height, 2, (ubyte)(format * 8), img_desc );
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+    // color correction -- data is in RGB, need BGR.  the file is always
+    // written bottom row first, a whole row at a time.
+    for( row = 0; row < (uint32)height; row++ ) {
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+        line = dat + (size_t)(row_order == TGA_TOP_DOWN ? height - 1 - row : row) * row_bytes;
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &width, 2, 1, tga );
-    fwrite( &height, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
+        if( stage.cap - stage.len < row_bytes ) {
+            tga_stage_flush( &stage );
+        }
 
+        tga_pack_row( line, stage.buf + stage.len, width, format );
+        stage.len += row_bytes;
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+    }
 
-    // color correction -- data is in RGB, need BGR.
-    for( i = 0; i < size; i++ ) {
+    return( tga_stage_close( &stage, error ) );
 
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[i*format+j] << (8 * j);
-        }
+}
 
-        switch( format ) {
 
-        case TGA_TRUECOLOR_24:
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
 
-            pixbuf = htotl( pixbuf );
-            
-            fwrite( &pixbuf, 3, 1, tga );
 
-            break;
 
-        case TGA_TRUECOLOR_32:
+int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
 
-            /* need to un-premultiply alpha.. */
+    return( tga_write_rle_ex( file, width, height, dat, format, TGA_BOTTOM_UP ) );
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
+}
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
 
-            /* clamp to 1.0f */
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-           
-            fwrite( &pixbuf, 4, 1, tga );
+int tga_write_rle_ex( const char * file, int width, int height, const unsigned char * dat, 
+                      unsigned int format, int row_order ) {
 
-            break;
-
-        }
-
-    }
-
-    fclose( tga );
-
-    return( 1 );
+    return( tga_write_rle_r( file, width, height, dat, format, row_order, &TargaError ) );
 
 }
 
 
 
 
-
-int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format ) {
+/* tga_write_rle_ex, reporting errors through error */
+int tga_write_rle_r( const char * file, int width, int height, const unsigned char * dat, 
+                     unsigned int format, int row_order, int * error ) {
 
     FILE * tga;
+    tga_stage stage;
 
-    uint32 i, j;
-    uint32 oc, nc;
-
-    enum RLE_STATE { INIT, NONE, RLP, RAWP };
-
-    int state = INIT;
-
-    uint32 size = width * height;
-
-    uint16 shortwidth = (uint16)width;
-    uint16 shortheight = (uint16)height;
-
-    ubyte repcount;
-
-    float red, green, blue, alpha;
+    uint32 row;
+    uint32 row_bound = (uint32)tga_rle_bound( width, 1, format );
 
-    int idx, row, column;
+    // converted pixels of the row being encoded.
+    ubyte * linebuf;
 
-    // have to buffer a whole line for raw packets.
-    unsigned char * rawbuf = (unsigned char *)malloc( width * format );  
+    ubyte img_desc;
 
-    char id[] = "written with libtarga";
-    ubyte idlen = 21;
-    ubyte zeroes[5] = { 0, 0, 0, 0, 0 };
-    uint32 pixbuf;
-    ubyte one = 1;
-    ubyte cmap_type = 0;
-    ubyte img_type  = 10;  // 2 - uncompressed truecolor  10 - RLE truecolor
-    uint16 xorigin  = 0;
-    uint16 yorigin  = 0;
-    ubyte  pixdepth = format * 8;  // bpp
-    ubyte img_desc  = format == TGA_TRUECOLOR_32 ? 8 : 0;
-  
 
     switch( format ) {
+
     case TGA_TRUECOLOR_24:
+        img_desc = 0;
+        break;
+
     case TGA_TRUECOLOR_32:
+        img_desc = 8;
         break;
 
     default:
-        TargaError = TGA_ERR_BAD_FORMAT;
+        *error = TGA_ERR_BAD_FORMAT;
         return( 0 );
-    }
 
+    }
 
     tga = fopen( file, "wb" );
 
     if( tga == NULL ) {
-        TargaError = TGA_ERR_OPEN_FAILS;
+        *error = TGA_ERR_OPEN_FAILS;
         return( 0 );
     }
 
-    // write id length
-    fwrite( &idlen, 1, 1, tga );
+    linebuf = (ubyte *)malloc( width * format );
 
-    // write colormap type
-    fwrite( &cmap_type, 1, 1, tga );
+    if( linebuf == NULL || !tga_stage_open( &stage, tga, row_bound ) ) {
+        free( linebuf );
+        fclose( tga );
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
+    }
 
-    // write image type
-    fwrite( &img_type, 1, 1, tga );
+    stage.len = tga_make_header( stage.buf, width, height, 10, (ubyte)(format * 8), img_desc );
 
-    // write cmap spec.
-    fwrite( &zeroes, 5, 1, tga );
+    // encode straight into the staging buffer, one row at a time.
+    for( row = 0; row < (uint32)height; row++ ) {
 
-    // write image spec.
-    fwrite( &xorigin, 2, 1, tga );
-    fwrite( &yorigin, 2, 1, tga );
-    fwrite( &shortwidth, 2, 1, tga );
-    fwrite( &shortheight, 2, 1, tga );
-    fwrite( &pixdepth, 1, 1, tga );
-    fwrite( &img_desc, 1, 1, tga );
+        if( stage.cap - stage.len < row_bound ) {
+            tga_stage_flush( &stage );
+        }
 
+        tga_pack_row( dat + (size_t)(row_order == TGA_TOP_DOWN ? height - 1 - row : row) * width * format, 
+                      linebuf, width, format );
+        stage.len += tga_rle_encode_row( linebuf, width, format, stage.buf + stage.len );
 
-    // write image id.
-    fwrite( &id, idlen, 1, tga );
+    }
 
-    // initial color values -- just to shut up the compiler.
-    nc = 0;
+    free( linebuf );
 
-    // color correction -- data is in RGB, need BGR.
-    // also run-length-encoding.
-    for( i = 0; i < size; i++ ) {
+    return( tga_stage_close( &stage, error ) );
 
-        idx = i * format;
+}
 
-        row = i / width;
-        column = i % width;
 
-        //printf( "row: %d, col: %d\n", row, column );
-        pixbuf = 0;
-        for( j = 0; j < format; j++ ) {
-            pixbuf += dat[idx+j] << (8 * j);
-        }
 
-        switch( format ) {
 
-        case TGA_TRUECOLOR_24:
+/* worst case size of rows run-length encoded by tga_encode_rle_rows */
+size_t tga_rle_bound( int width, int rows, unsigned int format ) {
 
-            pixbuf = ((pixbuf & 0xFF) << 16) + 
-                     (pixbuf & 0xFF00) + 
-                     ((pixbuf & 0xFF0000) >> 16);
+    // all raw packets -- a header byte for every 128 pixels.
+    return( ((size_t)width * format + (width + 127) / 128) * rows );
 
-            pixbuf = htotl( pixbuf );
-            break;
+}
 
-        case TGA_TRUECOLOR_32:
 
-            /* need to un-premultiply alpha.. */
 
-            red     = (pixbuf & 0xFF) / 255.0f;
-            green   = ((pixbuf & 0xFF00) >> 8) / 255.0f;
-            blue    = ((pixbuf & 0xFF0000) >> 16) / 255.0f;
-            alpha   = ((pixbuf & 0xFF000000) >> 24) / 255.0f;
 
-            if( alpha > 0.0001 ) {
-                red /= alpha;
-                green /= alpha;
-                blue /= alpha;
-            }
+/* run-length encodes rows [first_row, first_row + rows) of the file */
+size_t tga_encode_rle_rows( const unsigned char * dat, int width, int height, unsigned int format, 
+                            int row_order, int first_row, int rows, unsigned char * out ) {
 
-            /* clamp to 1.0f */
+    return( tga_encode_rle_rows_r( dat, width, height, format, row_order, first_row, rows, out, &TargaError ) );
 
-            red = red > 1.0f ? 255.0f : red * 255.0f;
-            green = green > 1.0f ? 255.0f : green * 255.0f;
-            blue = blue > 1.0f ? 255.0f : blue * 255.0f;
-            alpha = alpha > 1.0f ? 255.0f : alpha * 255.0f;
+}
 
-            pixbuf = (ubyte)blue + (((ubyte)green) << 8) + 
-                (((ubyte)red) << 16) + (((ubyte)alpha) << 24);
-                
-            pixbuf = htotl( pixbuf );
-            break;
 
-        }
 
 
-        oc = nc;
+/* tga_encode_rle_rows, reporting errors through error */
+size_t tga_encode_rle_rows_r( const unsigned char * dat, int width, int height, unsigned int format, 
+                              int row_order, int first_row, int rows, unsigned char * out, int * error ) {
 
-        nc = pixbuf;
+    // packets never cross a scanline, so any split of the rows encodes
+    // to the same bytes as the whole image.  file rows count from the
+    // bottom of the image.
 
+    ubyte * linebuf;
+    size_t len = 0;
+    int row;
 
-        switch( state ) {
+    if( format != TGA_TRUECOLOR_24 && format != TGA_TRUECOLOR_32 ) {
+        *error = TGA_ERR_BAD_FORMAT;
+        return( 0 );
+    }
 
-        case INIT:
-            // this is just used to make sure we have 2 pixel values to consider.
-            state = NONE;
-            break;
+    linebuf = (ubyte *)malloc( width * format );
+    if( linebuf == NULL ) {
+        *error = TGA_ERR_NO_MEMORY;
+        return( 0 );
+    }
 
+    for( row = first_row; row < first_row + rows; row++ ) {
+        tga_pack_row( dat + (size_t)(row_order == TGA_TOP_DOWN ? height - 1 - row : row) * width * format, 
+                      linebuf, width, format );
+        len += tga_rle_encode_row( linebuf, width, format, out + len );
+    }
 
-        case NONE:
+    free( linebuf );
 
-            if( column == 0 ) {
-                // write a 1 pixel raw packet for the old pixel, then go thru again.
-                repcount = 0;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+    return( len );
 
-            if( nc == oc ) {
-                repcount = 0;
-                state = RLP;
-            } else {
-                repcount = 0;
-                state = RAWP;
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-            }
-            break;
+}
 
 
-        case RLP:
-            repcount++;
 
-            if( column == 0 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
 
-            if( repcount == 127 ) {
-                // finish off rlp.
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-                break;
-            }
+/* writes an RLE image whose pixel data was encoded in blocks */
+int tga_write_rle_blocks( const char * file, int width, int height, unsigned int format, 
+                          const unsigned char * const * blocks, const size_t * lengths, int count ) {
 
-            if( nc != oc ) {
-                // finish off rlp
-                repcount |= 0x80;
-                fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-                state = NONE;
-            }
-            break;
+    return( tga_write_rle_blocks_r( file, width, height, format, blocks, lengths, count, &TargaError ) );
 
+}
 
-        case RAWP:
-            repcount++;
 
-            if( column == 0 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
-            }
 
-            if( repcount == 127 ) {
-                // finish off rawp.
-                for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                    rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                    rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-                }
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                state = NONE;
-                break;
-            }
 
-            if( nc == oc ) {
-                // finish off rawp
-                repcount--;
-                fwrite( &repcount, 1, 1, tga );
-                fwrite( rawbuf, (repcount + 1) * format, 1, tga );
-                
-                // start new rlp
-                repcount = 0;
-                state = RLP;
-                break;
-            }
+/* tga_write_rle_blocks, reporting errors through error */
+int tga_write_rle_blocks_r( const char * file, int width, int height, unsigned int format, 
+                            const unsigned char * const * blocks, const size_t * lengths, int count, 
+                            int * error ) {
 
-            // continue making rawp
-            for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-                rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-                rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-            }
+    FILE * tga;
+    ubyte hdr[HDR_LENGTH + 255];
+    uint32 hdr_len;
+    int i;
+    int ok = 1;
 
-            break;
+    if( format != TGA_TRUECOLOR_24 && format != TGA_TRUECOLOR_32 ) {
+        *error = TGA_ERR_BAD_FORMAT;
+        return( 0 );
+    }
 
-        }
-       
+    tga = fopen( file, "wb" );
 
+    if( tga == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( 0 );
     }
 
+    // the blocks are already large, so no staging here.
+    setvbuf( tga, NULL, _IONBF, 0 );
 
-    // clean up state.
+    hdr_len = tga_make_header( hdr, width, height, 10, (ubyte)(format * 8), 
+                               format == TGA_TRUECOLOR_32 ? 8 : 0 );
+    ok = fwrite( hdr, 1, hdr_len, tga ) == hdr_len;
 
-    switch( state ) {
+    for( i = 0; ok && i < count; i++ ) {
+        ok = fwrite( blocks[i], 1, lengths[i], tga ) == lengths[i];
+    }
 
-    case INIT:
-        break;
+    if( fclose( tga ) != 0 ) {
+        ok = 0;
+    }
 
-    case NONE:
-        // write the last 2 pixels in a raw packet.
-        fwrite( &one, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&nc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &nc, format, 1, tga );
-#endif
-        break;
+    if( !ok ) {
+        *error = TGA_ERR_WRITE_FAILS;
+    }
 
-    case RLP:
-        repcount++;
-        repcount |= 0x80;
-        fwrite( &repcount, 1, 1, tga );
-#ifdef WORDS_BIGENDIAN
-                fwrite( (&oc)+4, format, 1, tga );  // byte order..
-#else
-                fwrite( &oc, format, 1, tga );
-#endif
-        break;
+    return( ok );
 
-    case RAWP:
-        repcount++;
-        for( j = 0; j < format; j++ ) {
-#ifdef WORDS_BIGENDIAN
-            rawbuf[(repcount * format) + j] = (ubyte)(*((&oc)+format-j-1));
-#else
-            rawbuf[(repcount * format) + j] = *(((ubyte *)(&oc)) + j);
-#endif
-        }
-        fwrite( &repcount, 1, 1, tga );
-        fwrite( rawbuf, (repcount + 1) * 3, 1, tga );
-        break;
+}
 
-    }
 
 
-    // close the file.
-    fclose( tga );
 
-    free( rawbuf );
+/* encodes a whole targa file into a malloc'ed buffer */
+void * tga_encode_memory( int width, int height, const unsigned char * dat, unsigned int format,
+                          int row_order, int compressed, size_t * size ) {
 
-    return( 1 );
+    return( tga_encode_memory_r( width, height, dat, format, row_order, compressed, size, &TargaError ) );
 
 }
 
 
 
 
+/* tga_encode_memory, reporting errors through error */
+void * tga_encode_memory_r( int width, int height, const unsigned char * dat, unsigned int format,
+                            int row_order, int compressed, size_t * size, int * error ) {
 
+    ubyte * buf;
+    ubyte * shrunk;
+    size_t len;
+    size_t bound;
+    uint32 row;
+    uint32 row_bytes = width * format;
 
-/*************************************************************************************************/
+    if( format != TGA_TRUECOLOR_24 && format != TGA_TRUECOLOR_32 ) {
+        *error = TGA_ERR_BAD_FORMAT;
+        return( NULL );
+    }
+
+    if( compressed ) {
+        bound = HDR_LENGTH + 255 + tga_rle_bound( width, height, format );
+    } else {
+        bound = HDR_LENGTH + 255 + (size_t)row_bytes * height;
+    }
 
+    buf = (ubyte *)malloc( bound );
+    if( buf == NULL ) {
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
 
+    len = tga_make_header( buf, width, height, (ubyte)(compressed ? 10 : 2), (ubyte)(format * 8), 
+                           (ubyte)(format == TGA_TRUECOLOR_32 ? 8 : 0) );
 
+    if( compressed ) {
+        // the row encoder also converts, so the bottom file row lands first.
+        bound = tga_encode_rle_rows_r( dat, width, height, format, row_order, 0, height, buf + len, error );
+        if( bound == 0 && width > 0 && height > 0 ) {
+            free( buf );
+            return( NULL );
+        }
+        len += bound;
+    } else {
+        for( row = 0; row < (uint32)height; row++ ) {
+            tga_pack_row( dat + (size_t)(row_order == TGA_TOP_DOWN ? height - 1 - row : row) * row_bytes, 
+                          buf + len, width, format );
+            len += row_bytes;
+        }
+    }
 
+    // give back what the encoding didn't use.
+    shrunk = (ubyte *)realloc( buf, len );
+    if( shrunk != NULL ) {
+        buf = shrunk;
+    }
 
+    *size = len;
 
+    return( buf );
 
-static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
-                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+}
 
-    // write the pixel to the data regarding how the
-    // header says the data is ordered.
 
-    uint32 j;
-    uint32 x, y;
-    uint32 addy;
 
-    switch( (img_spec & 0x30) >> 4 ) {
 
-    case TGA_LOWER_RIGHT:
-        x = w - 1 - (number % w);
-        y = number / h;
-        break;
 
-    case TGA_UPPER_LEFT:
-        x = number % w;
-        y = h - 1 - (number / w);
-        break;
 
-    case TGA_UPPER_RIGHT:
-        x = w - 1 - (number % w);
-        y = h - 1 - (number / w);
-        break;
+/* reads just the header of a targa */
+int tga_probe( const char * filename, tga_info * info ) {
 
-    case TGA_LOWER_LEFT:
-    default:
-        x = number % w;
-        y = number / w;
-        break;
+    FILE * targafile;
+    ubyte tga_hdr[HDR_LENGTH];
 
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        TargaError = TGA_ERR_OPEN_FAILS;
+        return( 0 );
     }
 
-    addy = (y * w + x) * format;
-    for( j = 0; j < format; j++ ) {
-        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+    if( fread( tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
+        fclose( targafile );
+        TargaError = TGA_ERR_BAD_HEADER;
+        return( 0 );
     }
-    
+
+    fclose( targafile );
+
+    tga_parse_header( tga_hdr, info );
+
+    return( 1 );
+
 }
 
 
 
 
+/* loads and converts a rectangle of a targa, (x, y) being its top left corner */
+void * tga_load_region( const char * filename, int x, int y, int width, int height, unsigned int format,
+                        int row_order, tga_alloc_func alloc, void * user ) {
 
-static uint32 tga_get_pixel( FILE * tga, ubyte bytes_per_pix, 
-                            ubyte * colormap, ubyte cmap_bytes_entry ) {
-    
-    /* get the image data value out */
+    return( tga_load_region_r( filename, x, y, width, height, format, row_order, alloc, user, &TargaError ) );
 
-    uint32 tmp_col;
-    uint32 tmp_int32;
-    ubyte tmp_byte;
+}
 
-    uint32 j;
 
-    tmp_int32 = 0;
-    for( j = 0; j < bytes_per_pix; j++ ) {
-        if( fread( &tmp_byte, 1, 1, tga ) < 1 ) {
-            tmp_int32 = 0;
-        } else {
-            tmp_int32 += tmp_byte << (j * 8);
+
+
+/* tga_load_region, reporting errors through error */
+void * tga_load_region_r( const char * filename, int x, int y, int width, int height, unsigned int format,
+                          int row_order, tga_alloc_func alloc, void * user, int * error ) {
+
+    // the truecolor files the stream reader handles only decode the
+    // rectangle: uncompressed rows are seeked to and RLE packets outside
+    // it are skipped unconverted.  anything else is loaded whole and cut.
+
+    tga_reader * reader;
+    ubyte * image_data;
+    ubyte * full;
+    int img_width, img_height, stored_order;
+    int row, first, last;
+    size_t row_bytes = (size_t)width * format;
+    size_t image_bytes;
+
+    reader = tga_open_reader( filename, &img_width, &img_height, format, &stored_order, error );
+
+    if( reader == NULL ) {
+
+        if( *error != TGA_ERR_BAD_IMAGE_TYPE ) {
+            return( NULL );
+        }
+
+        full = (ubyte *)tga_load_r( filename, &img_width, &img_height, format, TGA_TOP_DOWN, NULL, NULL, error );
+        if( full == NULL ) {
+            return( NULL );
         }
+
+    } else {
+
+        full = NULL;
+
     }
-    
-    /* byte-order correct the thing */
-    switch( bytes_per_pix ) {
-        
-    case 2:
-        tmp_int32 = ttohs( (uint16)tmp_int32 );
-        break;
-        
-    case 3: /* intentional fall-thru */
-    case 4:
-        tmp_int32 = ttohl( tmp_int32 );
-        break;
-        
+
+    if( width <= 0 || height <= 0 ) {
+        tga_reader_close( reader );
+        free( full );
+        *error = TGA_ERR_BAD_DIMENSIONS;
+        return( NULL );
     }
-    
-    if( colormap != NULL ) {
-        /* need to look up value to get real color */
-        tmp_col = 0;
-        for( j = 0; j < cmap_bytes_entry; j++ ) {
-            tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+
+    // written so that large arguments can't overflow
+    if( x < 0 || y < 0 || x > img_width - width || y > img_height - height ) {
+        tga_reader_close( reader );
+        free( full );
+        *error = TGA_ERR_OUTSIDE_IMAGE;
+        return( NULL );
+    }
+
+    image_data = NULL;
+    if( tga_image_bytes( width, height, format, &image_bytes ) ) {
+        image_data = alloc != NULL ? (ubyte *)alloc( user, image_bytes ) 
+                                   : (ubyte *)malloc( image_bytes );
+    }
+
+    if( image_data == NULL ) {
+        tga_reader_close( reader );
+        free( full );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+
+    if( full != NULL ) {
+
+        for( row = 0; row < height; row++ ) {
+            memcpy( image_data + (size_t)(row_order == TGA_TOP_DOWN ? row : height - 1 - row) * row_bytes,
+                    full + ((size_t)(y + row) * img_width + x) * format, row_bytes );
         }
-    } else {
-        tmp_col = tmp_int32;
+        free( full );
+
+        return( image_data );
+
     }
-    
-    return( tmp_col );
-    
-}
 
+    // stored rows [first, last] hold the rectangle.
+    first = stored_order == TGA_TOP_DOWN ? y : img_height - y - height;
+    last  = first + height - 1;
 
+    // a seek per row, so don't read ahead much more than a row.
+    if( !reader->rle && reader->cap > row_bytes + 4096 ) {
+        reader->cap = row_bytes + 4096;
+    }
 
+    tga_reader_skip_rows( reader, first );
 
+    for( row = first; row <= last; row++ ) {
 
-static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out ) {
-    
-    // this is not only responsible for converting from different depths
-    // to other depths, it also switches BGR to RGB.
+        // rectangle row counted from its top.
+        int top_row = stored_order == TGA_TOP_DOWN ? row - first : last - row;
 
-    // this thing will also premultiply alpha, on a pixel by pixel basis.
+        tga_reader_row( reader, 
+                        image_data + (size_t)(row_order == TGA_TOP_DOWN ? top_row : height - 1 - top_row) * row_bytes,
+                        x, width );
 
-    ubyte r, g, b, a;
+    }
 
-    switch( bpp_in ) {
-        
-    case 32:
-        if( alphabits == 0 ) {
-            goto is_24_bit_in_disguise;
+    if( reader->failed ) {
+        tga_reader_close( reader );
+        if( alloc == NULL ) {
+            free( image_data );
         }
-        // 32-bit to 32-bit -- nop.
-        break;
-        
-    case 24:
-is_24_bit_in_disguise:
+        *error = TGA_ERR_READ_FAILS;
+        return( NULL );
+    }
+
+    tga_reader_close( reader );
+
+    return( image_data );
+
+}
+
+
+
+
+/* loads a targa at 1/factor of its size */
+void * tga_load_scaled( const char * filename, int factor, int * width, int * height, unsigned int format,
+                        int row_order, tga_alloc_func alloc, void * user ) {
+
+    return( tga_load_scaled_r( filename, factor, width, height, format, row_order, alloc, user, &TargaError ) );
+
+}
+
+
+
+
+/* tga_load_scaled, reporting errors through error */
+void * tga_load_scaled_r( const char * filename, int factor, int * width, int * height, unsigned int format,
+                          int row_order, tga_alloc_func alloc, void * user, int * error ) {
+
+    // each output pixel is the rounded average of a factor x factor block,
+    // blocks counted from the top left; those on the right and bottom
+    // edges average only the pixels they cover.  rows are decoded one at
+    // a time and added into per-column sums, so only a row and the sums
+    // are ever held.  files the stream reader doesn't handle are loaded
+    // whole and shrunk.
+
+    tga_reader * reader;
+    ubyte * image_data;
+    ubyte * full;
+    ubyte * line;
+    uint32 * sums;
+    int img_width, img_height, stored_order;
+    uint32 out_width, out_height;
+    uint32 block, rows, row, top_block;
+    size_t out_row_bytes;
+    size_t image_bytes;
+    size_t row_len;
+
+    if( factor < 1 ) {
+        *error = TGA_ERR_BAD_DIMENSIONS;
+        return( NULL );
+    }
+
+    reader = tga_open_reader( filename, &img_width, &img_height, format, &stored_order, error );
+
+    if( reader == NULL ) {
+
+        if( *error != TGA_ERR_BAD_IMAGE_TYPE ) {
+            return( NULL );
+        }
+
+        full = (ubyte *)tga_load_r( filename, &img_width, &img_height, format, TGA_TOP_DOWN, NULL, NULL, error );
+        if( full == NULL ) {
+            return( NULL );
+        }
+
+        stored_order = TGA_TOP_DOWN;
+
+    } else {
+
+        full = NULL;
+
+    }
+
+    out_width  = (img_width + factor - 1) / factor;
+    out_height = (img_height + factor - 1) / factor;
+    out_row_bytes = (size_t)out_width * format;
+    row_len = (size_t)img_width * format;
+
+    image_data = NULL;
+    if( tga_image_bytes( out_width, out_height, format, &image_bytes ) ) {
+        image_data = alloc != NULL ? (ubyte *)alloc( user, image_bytes ) 
+                                   : (ubyte *)malloc( image_bytes );
+    }
+    line = full != NULL ? NULL : (ubyte *)malloc( row_len );
+    sums = (uint32 *)calloc( row_len, sizeof( uint32 ) );
+
+    if( image_data == NULL || (full == NULL && line == NULL) || sums == NULL ) {
+        // image_data belongs to the allocator's owner if there is one.
+        if( alloc == NULL ) {
+            free( image_data );
+        }
+        free( line );
+        free( sums );
+        free( full );
+        tga_reader_close( reader );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+
+    // blocks in stored order; a bottom-up file starts with the bottom
+    // block, which is the short one if the height doesn't divide.
+    for( block = 0; block < out_height; block++ ) {
+
+        top_block = stored_order == TGA_TOP_DOWN ? block : out_height - 1 - block;
+        rows = top_block == out_height - 1 ? img_height - top_block * factor : (uint32)factor;
+
+        for( row = 0; row < rows; row++ ) {
+
+            if( full != NULL ) {
+                line = full + ((size_t)top_block * factor + row) * row_len;
+            } else {
+                tga_read_band( reader, line, 1 );
+            }
+
+            tga_add_row( sums, line, row_len );
+
+        }
+
+        tga_shrink_sums( sums, img_width, rows, factor, format, 
+                         image_data + (row_order == TGA_TOP_DOWN ? top_block : out_height - 1 - top_block) * out_row_bytes );
+
+    }
+
+    if( full != NULL ) {
+        free( full );
+    } else {
+        free( line );
+    }
+    free( sums );
+    tga_reader_close( reader );
+
+    *width  = out_width;
+    *height = out_height;
+
+    return( image_data );
+
+}
+
+
+
+
+/* opens a targa for decoding a band at a time */
+tga_reader * tga_reader_open( const char * filename, int * width, int * height, unsigned int format,
+                              int * row_order ) {
+
+    return( tga_open_reader( filename, width, height, format, row_order, &TargaError ) );
+
+}
+
+
+
+
+static tga_reader * tga_open_reader( const char * filename, int * width, int * height, unsigned int format,
+                                     int * row_order, int * error ) {
+
+    // only the header is read here.  rows come back in the order they
+    // are stored, which the caller learns through row_order; that way
+    // no band ever depends on a row that hasn't been read yet.
+
+    FILE * targafile;
+    tga_reader * reader;
+    ubyte tga_hdr[HDR_LENGTH];
+    tga_info info;
+    uint32 tmp_col;
+
+    if( format != TGA_TRUECOLOR_24 && format != TGA_TRUECOLOR_32 ) {
+        *error = TGA_ERR_BAD_FORMAT;
+        return( NULL );
+    }
+
+    targafile = fopen( filename, "rb" );
+    if( targafile == NULL ) {
+        *error = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
+
+    if( fread( tga_hdr, 1, HDR_LENGTH, targafile ) != HDR_LENGTH ) {
+        fclose( targafile );
+        *error = TGA_ERR_BAD_HEADER;
+        return( NULL );
+    }
+
+    tga_parse_header( tga_hdr, &info );
+
+    // streaming covers the truecolor images big enough to need it.
+    if( (info.image_type != TGA_IMG_UNC_TRUECOLOR && info.image_type != TGA_IMG_RLE_TRUECOLOR) ||
+        info.paletted || (info.depth != 24 && info.depth != 32) ) {
+        fclose( targafile );
+        *error = TGA_ERR_BAD_IMAGE_TYPE;
+        return( NULL );
+    }
+
+    reader = (tga_reader *)calloc( 1, sizeof( tga_reader ) );
+    if( reader != NULL ) {
+        reader->cap = TGA_STREAM_BYTES;
+        reader->buf = (ubyte *)malloc( reader->cap );
+    }
+    if( reader == NULL || reader->buf == NULL ) {
+        free( reader );
+        fclose( targafile );
+        *error = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+
+    reader->file          = targafile;
+    reader->width         = info.width;
+    reader->height        = info.height;
+    reader->format        = format;
+    reader->bytes_per_pix = (ubyte)(info.depth >> 3);
+    reader->has_alpha     = info.depth == 32 && info.alpha_bits;
+    reader->rle           = info.compressed;
+    reader->mirrored      = (tga_hdr[HDR_IMG_SPEC_IMG_DESC] & 0x10) != 0;
+    reader->data_start    = HDR_LENGTH + tga_hdr[HDR_IDLEN];
+
+    // reads are already large, so skip stdio's copy.
+    setvbuf( targafile, NULL, _IONBF, 0 );
+
+    if( reader->width == 0 || reader->height == 0 ) {
+        tga_reader_close( reader );
+        *error = TGA_ERR_BAD_DIMENSIONS;
+        return( NULL );
+    }
+
+    // skip the image id.
+    if( tga_reader_fill( reader, tga_hdr[HDR_IDLEN] ) < tga_hdr[HDR_IDLEN] ) {
+        reader->pos = reader->len;
+    } else {
+        reader->pos += tga_hdr[HDR_IDLEN];
+    }
+
+    tmp_col = reader->has_alpha ? 0 : tga_convert_color( 0, 24, 0, format );
+    reader->missing[0] = (ubyte)(tmp_col & 0xFF);
+    reader->missing[1] = (ubyte)((tmp_col >> 8) & 0xFF);
+    reader->missing[2] = (ubyte)((tmp_col >> 16) & 0xFF);
+    reader->missing[3] = (ubyte)((tmp_col >> 24) & 0xFF);
+
+    if( reader->has_alpha ) {
+        tga_build_tables();
+    }
+
+    *width     = reader->width;
+    *height    = reader->height;
+    *row_order = info.row_order;
+
+    return( reader );
+
+}
+
+
+
+
+/* decodes up to rows scanlines; returns the number decoded, 0 at the end */
+int tga_read_band( tga_reader * reader, unsigned char * dat, int rows ) {
+
+    int row;
+
+    if( rows < 0 ) {
+        rows = 0;
+    }
+    if( rows > (int)(reader->height - reader->row) ) {
+        rows = (int)(reader->height - reader->row);
+    }
+
+    for( row = 0; row < rows; row++ ) {
+        tga_reader_row( reader, dat + (size_t)row * reader->width * reader->format, 0, reader->width );
+    }
+
+    return( rows );
+
+}
+
+
+
+
+void tga_reader_close( tga_reader * reader ) {
+
+    if( reader == NULL ) {
+        return;
+    }
+
+    fclose( reader->file );
+    free( reader->buf );
+    free( reader );
+
+}
+
+
+
+
+/* creates a targa to be encoded a band at a time */
+tga_writer * tga_writer_open( const char * filename, int width, int height, unsigned int format,
+                              int row_order, int compressed ) {
+
+    // a top-down stream gets an upper-left origin in the header so the
+    // rows can go out in the order they arrive.
+
+    FILE * tga;
+    tga_writer * writer;
+    uint32 row_bound;
+    ubyte img_desc;
+
+    if( format != TGA_TRUECOLOR_24 && format != TGA_TRUECOLOR_32 ) {
+        TargaError = TGA_ERR_BAD_FORMAT;
+        return( NULL );
+    }
+
+    img_desc = (ubyte)(format == TGA_TRUECOLOR_32 ? 8 : 0);
+    if( row_order == TGA_TOP_DOWN ) {
+        img_desc |= (TGA_UPPER_LEFT << 4);
+    }
+
+    tga = fopen( filename, "wb" );
+    if( tga == NULL ) {
+        TargaError = TGA_ERR_OPEN_FAILS;
+        return( NULL );
+    }
+
+    row_bound = compressed ? (uint32)tga_rle_bound( width, 1, format ) : width * format;
+
+    writer = (tga_writer *)calloc( 1, sizeof( tga_writer ) );
+    if( writer != NULL ) {
+        writer->linebuf = (ubyte *)malloc( width * format );
+    }
+    if( writer == NULL || writer->linebuf == NULL || !tga_stage_open( &writer->stage, tga, row_bound ) ) {
+        if( writer != NULL ) {
+            free( writer->linebuf );
+        }
+        free( writer );
+        fclose( tga );
+        TargaError = TGA_ERR_NO_MEMORY;
+        return( NULL );
+    }
+
+    writer->width  = width;
+    writer->height = height;
+    writer->format = format;
+    writer->rle    = compressed;
+
+    writer->stage.len = tga_make_header( writer->stage.buf, width, height, (ubyte)(compressed ? 10 : 2), 
+                                         (ubyte)(format * 8), img_desc );
+
+    return( writer );
+
+}
+
+
+
+
+/* encodes the next rows scanlines, given in the writer's row order */
+int tga_write_band( tga_writer * writer, const unsigned char * dat, int rows ) {
+
+    uint32 row_bytes = writer->width * writer->format;
+    uint32 row_bound = writer->rle ? (uint32)tga_rle_bound( writer->width, 1, writer->format ) : row_bytes;
+    int row;
+
+    if( rows < 0 || (uint32)rows > writer->height - writer->rows_done ) {
+        TargaError = TGA_ERR_BAD_DIMENSIONS;
+        return( 0 );
+    }
+
+    for( row = 0; row < rows; row++, dat += row_bytes ) {
+
+        if( writer->stage.cap - writer->stage.len < row_bound ) {
+            tga_stage_flush( &writer->stage );
+        }
+
+        if( writer->rle ) {
+            tga_pack_row( dat, writer->linebuf, writer->width, writer->format );
+            writer->stage.len += tga_rle_encode_row( writer->linebuf, writer->width, writer->format, 
+                                                     writer->stage.buf + writer->stage.len );
+        } else {
+            tga_pack_row( dat, writer->stage.buf + writer->stage.len, writer->width, writer->format );
+            writer->stage.len += row_bytes;
+        }
+
+    }
+
+    writer->rows_done += rows;
+
+    return( !writer->stage.failed );
+
+}
+
+
+
+
+/* finishes the file; returns 1 if every row was written */
+int tga_writer_close( tga_writer * writer ) {
+
+    int ok;
+    int complete = writer->rows_done == writer->height;
+
+    ok = tga_stage_close( &writer->stage, &TargaError );
+
+    free( writer->linebuf );
+    free( writer );
+
+    if( ok && !complete ) {
+        TargaError = TGA_ERR_BAD_DIMENSIONS;
+        return( 0 );
+    }
+
+    return( ok );
+
+}
+
+
+
+
+
+
+/*************************************************************************************************/
+
+
+
+
+
+
+
+static void tga_write_pixel_to_mem( ubyte * dat, ubyte img_spec, uint32 number, 
+                                   uint32 w, uint32 h, uint32 pixel, uint32 format ) {
+
+    // write the pixel to the data regarding how the
+    // header says the data is ordered.
+
+    uint32 j;
+    uint32 x, y;
+    size_t addy;
+
+    switch( (img_spec & 0x30) >> 4 ) {
+
+    case TGA_LOWER_RIGHT:
+        x = w - 1 - (number % w);
+        y = number / w;
+        break;
+
+    case TGA_UPPER_LEFT:
+        x = number % w;
+        y = h - 1 - (number / w);
+        break;
+
+    case TGA_UPPER_RIGHT:
+        x = w - 1 - (number % w);
+        y = h - 1 - (number / w);
+        break;
+
+    case TGA_LOWER_LEFT:
+    default:
+        x = number % w;
+        y = number / w;
+        break;
+
+    }
+
+    addy = ((size_t)y * w + x) * format;
+    for( j = 0; j < format; j++ ) {
+        dat[addy + j] = (ubyte)((pixel >> (j * 8)) & 0xFF);
+    }
+    
+}
+
+
+
+
+
+static int tga_read_byte( tga_cursor * src, ubyte * out ) {
+
+    if( src->pos >= src->len ) {
+        return( 0 );
+    }
+
+    *out = src->data[src->pos++];
+    return( 1 );
+
+}
+
+
+
+
+
+static uint32 tga_get_pixel( tga_cursor * src, ubyte bytes_per_pix, 
+                            ubyte * colormap, ubyte cmap_bytes_entry, uint32 cmap_length ) {
+    
+    /* get the image data value out */
+
+    uint32 tmp_col;
+    uint32 tmp_int32;
+    ubyte tmp_byte;
+
+    uint32 j;
+
+    tmp_int32 = 0;
+    for( j = 0; j < bytes_per_pix; j++ ) {
+        if( !tga_read_byte( src, &tmp_byte ) ) {
+            tmp_int32 = 0;
+        } else {
+            tmp_int32 += tmp_byte << (j * 8);
+        }
+    }
+    
+    /* byte-order correct the thing */
+    switch( bytes_per_pix ) {
+        
+    case 2:
+        tmp_int32 = ttohs( (uint16)tmp_int32 );
+        break;
+        
+    case 3: /* intentional fall-thru */
+    case 4:
+        tmp_int32 = ttohl( tmp_int32 );
+        break;
+        
+    }
+    
+    if( colormap != NULL ) {
+        /* need to look up value to get real color */
+        tmp_col = 0;
+        for( j = 0; j < cmap_bytes_entry && tmp_int32 < cmap_length; j++ ) {
+            tmp_col += colormap[cmap_bytes_entry * tmp_int32 + j] << (8 * j);
+        }
+    } else {
+        tmp_col = tmp_int32;
+    }
+    
+    return( tmp_col );
+    
+}
+
+
+
+
+
+static uint32 tga_convert_color( uint32 pixel, uint32 bpp_in, ubyte alphabits, uint32 format_out ) {
+    
+    // this is not only responsible for converting from different depths
+    // to other depths, it also switches BGR to RGB.
+
+    // this thing will also premultiply alpha, on a pixel by pixel basis.
+
+    ubyte r, g, b, a;
+
+    switch( bpp_in ) {
+        
+    case 32:
+        if( alphabits == 0 ) {
+            goto is_24_bit_in_disguise;
+        }
+        // 32-bit to 32-bit -- nop.
+        break;
+        
+    case 24:
+is_24_bit_in_disguise:
         // 24-bit to 32-bit; (only force alpha to full)
         pixel |= 0xFF000000;
         break;
 
-    case 15:
-is_15_bit_in_disguise:
-        r = (ubyte)(((float)((pixel & 0x7C00) >> 10)) * 8.2258f);
-        g = (ubyte)(((float)((pixel & 0x03E0) >> 5 )) * 8.2258f);
-        b = (ubyte)(((float)(pixel & 0x001F)) * 8.2258f);
-        // 15-bit to 32-bit; (force alpha to full)
-        pixel = 0xFF000000 + (r << 16) + (g << 8) + b;
-        break;
-        
-    case 16:
-        if( alphabits == 1 ) {
-            goto is_15_bit_in_disguise;
+    case 15:
+is_15_bit_in_disguise:
+        r = (ubyte)(((float)((pixel & 0x7C00) >> 10)) * 8.2258f);
+        g = (ubyte)(((float)((pixel & 0x03E0) >> 5 )) * 8.2258f);
+        b = (ubyte)(((float)(pixel & 0x001F)) * 8.2258f);
+        // 15-bit to 32-bit; (force alpha to full)
+        pixel = 0xFF000000 + (r << 16) + (g << 8) + b;
+        break;
+        
+    case 16:
+        if( alphabits == 1 ) {
+            goto is_15_bit_in_disguise;
+        }
+        // 16-bit to 32-bit; (force alpha to full)
+        r = (ubyte)(((float)((pixel & 0xF800) >> 11)) * 8.2258f);
+        g = (ubyte)(((float)((pixel & 0x07E0) >> 5 )) * 4.0476f);
+        b = (ubyte)(((float)(pixel & 0x001F)) * 8.2258f);
+        pixel = 0xFF000000 + (r << 16) + (g << 8) + b;
+        break;
+       
+    }
+    
+    // convert the 32-bit pixel from BGR to RGB.
+    pixel = (pixel & 0xFF00FF00) + ((pixel & 0xFF) << 16) + ((pixel & 0xFF0000) >> 16);
+
+    r = pixel & 0x000000FF;
+    g = (pixel & 0x0000FF00) >> 8;
+    b = (pixel & 0x00FF0000) >> 16;
+    a = (pixel & 0xFF000000) >> 24;
+    
+    // not premultiplied alpha -- multiply.
+    r = tga_premultiply( r, a );
+    g = tga_premultiply( g, a );
+    b = tga_premultiply( b, a );
+
+    pixel = r + (g << 8) + (b << 16) + (a << 24);
+
+    /* now convert from 32-bit to whatever they want. */
+    
+    switch( format_out ) {
+        
+    case TGA_TRUECOLOR_32:
+        // 32 to 32 -- nop.
+        break;
+        
+    case TGA_TRUECOLOR_24:
+        // 32 to 24 -- discard alpha.
+        pixel &= 0x00FFFFFF;
+        break;
+        
+    }
+
+    return( pixel );
+
+}
+
+
+
+
+static ubyte tga_premultiply( ubyte c, ubyte a ) {
+
+    // the scanline converters read this through tga_premul_table, so
+    // every path rounds exactly the same way.
+    return( (ubyte)(((float)c / 255.0f) * ((float)a / 255.0f) * 255.0f) );
+
+}
+
+
+
+
+static ubyte tga_unpremultiply( ubyte c, ubyte a ) {
+
+    // the writers' conversion back to straight alpha; tga_pack_row reads
+    // it through tga_unpremul_table.
+
+    float value = c / 255.0f;
+    float alpha = a / 255.0f;
+
+    if( alpha > 0.0001 ) {
+        value /= alpha;
+    }
+
+    /* clamp to 1.0f */
+    value = value > 1.0f ? 255.0f : value * 255.0f;
+
+    return( (ubyte)value );
+
+}
+
+
+
+
+static void tga_fill_tables( void ) {
+
+    uint32 a, c;
+
+    for( a = 0; a < 256; a++ ) {
+        for( c = 0; c < 256; c++ ) {
+            tga_premul_table[a][c] = tga_premultiply( (ubyte)c, (ubyte)a );
+            tga_unpremul_table[a][c] = tga_unpremultiply( (ubyte)c, (ubyte)a );
+        }
+    }
+
+}
+
+
+
+
+#if defined(_WIN32)
+static BOOL CALLBACK tga_fill_tables_once( PINIT_ONCE once, PVOID param, PVOID * context ) {
+
+    tga_fill_tables();
+    return( TRUE );
+
+}
+#endif
+
+
+
+
+static void tga_build_tables( void ) {
+
+    // safe to call from any number of threads at once; the tables are
+    // complete by the time any call returns.
+
+#if defined(_WIN32)
+    InitOnceExecuteOnce( &tga_tables_once, tga_fill_tables_once, NULL, NULL );
+#else
+    pthread_once( &tga_tables_once, tga_fill_tables );
+#endif
+
+}
+
+
+
+
+static int tga_map_payload( FILE * tga, tga_payload * payload ) {
+
+    // get a whole file into memory without going through stdio a byte at
+    // a time: mapped where we can, read in one call where we can't.
+
+    tga_off size = -1;
+
+    payload->data = NULL;
+    payload->len = 0;
+    payload->base = NULL;
+    payload->base_len = 0;
+    payload->mapped = 0;
+
+#ifdef TGA_HAVE_MMAP
+    {
+        struct stat st;
+        void * base;
+
+        if( fstat( fileno( tga ), &st ) == 0 && st.st_size > 0 ) {
+
+            base = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno( tga ), 0 );
+
+            if( base != MAP_FAILED ) {
+                payload->base = base;
+                payload->base_len = (size_t)st.st_size;
+                payload->mapped = 1;
+                payload->data = (const ubyte *)base;
+                payload->len = (size_t)st.st_size;
+#ifdef MADV_SEQUENTIAL
+                madvise( base, payload->base_len, MADV_SEQUENTIAL );
+#endif
+                return( 1 );
+            }
+        }
+    }
+#endif
+
+    if( tga_fseek( tga, 0, SEEK_END ) == 0 ) {
+        size = tga_ftell( tga );
+    }
+    if( size < 0 || (unsigned long long)size > (size_t)-1 || tga_fseek( tga, 0, SEEK_SET ) != 0 ) {
+        return( 0 );
+    }
+
+    payload->base = malloc( size ? (size_t)size : 1 );
+    if( payload->base == NULL ) {
+        return( 0 );
+    }
+
+    payload->data = (const ubyte *)payload->base;
+    payload->len = fread( payload->base, 1, (size_t)size, tga );
+
+    return( 1 );
+
+}
+
+
+
+
+static void tga_unmap_payload( tga_payload * payload ) {
+
+#ifdef TGA_HAVE_MMAP
+    if( payload->mapped ) {
+        munmap( payload->base, payload->base_len );
+        payload->base = NULL;
+        return;
+    }
+#endif
+
+    free( payload->base );
+    payload->base = NULL;
+
+}
+
+
+
+
+static void tga_convert_row( const ubyte * src, ubyte * dst, uint32 count, 
+                             ubyte bytes_per_pix, int has_alpha, uint32 format ) {
+
+    // convert a run of BGR(A) file pixels to premultiplied RGB(A); this
+    // gives the same bytes as tga_convert_color does for 24/32-bit input.
+
+    uint32 i = 0;
+    uint32 pixel;
+    const ubyte * row;
+
+    if( has_alpha ) {
+
+        for( i = 0; i < count; i++, src += 4, dst += format ) {
+            row = tga_premul_table[src[3]];
+            dst[0] = row[src[2]];
+            dst[1] = row[src[1]];
+            dst[2] = row[src[0]];
+            if( format == TGA_TRUECOLOR_32 ) {
+                dst[3] = src[3];
+            }
+        }
+        return;
+
+    }
+
+    if( format == TGA_TRUECOLOR_32 ) {
+
+#if defined(TGA_HAVE_SSE2) && !defined(WORDS_BIGENDIAN)
+        if( bytes_per_pix == 4 ) {
+
+            // opaque 32-bit pixels only need red and blue swapped.
+            const __m128i mask_ga = _mm_set1_epi32( (int)0xFF00FF00 );
+            const __m128i mask_rb = _mm_set1_epi32( 0x00FF00FF );
+            const __m128i opaque  = _mm_set1_epi32( (int)0xFF000000 );
+
+            for( ; i + 4 <= count; i += 4, src += 16, dst += 16 ) {
+                __m128i v  = _mm_loadu_si128( (const __m128i *)src );
+                __m128i rb = _mm_and_si128( v, mask_rb );
+                rb = _mm_shufflehi_epi16( _mm_shufflelo_epi16( rb, 0xB1 ), 0xB1 );
+                v  = _mm_or_si128( _mm_or_si128( _mm_and_si128( v, mask_ga ), rb ), opaque );
+                _mm_storeu_si128( (__m128i *)dst, v );
+            }
+        }
+#endif
+
+#ifndef WORDS_BIGENDIAN
+        // word at a time; the last pixel is left to the byte loop so we
+        // never read past the end of the source.
+        for( ; i + 1 < count; i++, src += bytes_per_pix, dst += 4 ) {
+            memcpy( &pixel, src, 4 );
+            pixel = (pixel & 0x0000FF00) + ((pixel & 0xFF) << 16) + ((pixel & 0xFF0000) >> 16) + 0xFF000000;
+            memcpy( dst, &pixel, 4 );
+        }
+#endif
+
+    }
+
+    for( ; i < count; i++, src += bytes_per_pix, dst += format ) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if( format == TGA_TRUECOLOR_32 ) {
+            dst[3] = 0xFF;
+        }
+    }
+
+}
+
+
+
+
+static void tga_load_unc_truecolor( const ubyte * src, size_t len, ubyte * dat, uint32 w, uint32 h, 
+                                    ubyte bytes_per_pix, int has_alpha, ubyte img_desc, uint32 format ) {
+
+    // bulk loader for uncompressed 24/32-bit images with a left-hand origin.
+
+    uint32 row, y;
+    uint32 row_bytes = w * bytes_per_pix;
+    uint32 have;
+    uint32 missing = has_alpha ? 0 : tga_convert_color( 0, 24, 0, format );
+
+    if( has_alpha ) {
+        tga_build_tables();
+    }
+
+    for( row = 0; row < h; row++ ) {
+
+        // same placement as tga_write_pixel_to_mem.
+        y = (((img_desc & 0x30) >> 4) == TGA_UPPER_LEFT) ? h - 1 - row : row;
+
+        if( len >= (size_t)(row + 1) * row_bytes ) {
+            have = w;
+        } else if( len > (size_t)row * row_bytes ) {
+            have = (uint32)((len - (size_t)row * row_bytes) / bytes_per_pix);
+        } else {
+            have = 0;
+        }
+
+        if( have ) {
+            tga_convert_row( src + (size_t)row * row_bytes, dat + (size_t)y * w * format, 
+                             have, bytes_per_pix, has_alpha, format );
+        }
+
+        // pixels past the end of a short file come out as zero.
+        for( ; have < w; have++ ) {
+            tga_write_pixel_to_mem( dat + (size_t)y * w * format, 0, have, w, 1, missing, format );
+        }
+
+    }
+
+}
+
+
+
+
+static void tga_fill_span( ubyte * dst, uint32 count, const ubyte * pixel, uint32 format ) {
+
+    // write count copies of one converted pixel.
+
+    uint32 i = 0;
+    uint32 word;
+
+    if( format == TGA_TRUECOLOR_32 ) {
+
+        memcpy( &word, pixel, 4 );
+
+#ifdef TGA_HAVE_SSE2
+        {
+            const __m128i v = _mm_set1_epi32( (int)word );
+            for( ; i + 4 <= count; i += 4, dst += 16 ) {
+                _mm_storeu_si128( (__m128i *)dst, v );
+            }
         }
-        // 16-bit to 32-bit; (force alpha to full)
-        r = (ubyte)(((float)((pixel & 0xF800) >> 11)) * 8.2258f);
-        g = (ubyte)(((float)((pixel & 0x07E0) >> 5 )) * 4.0476f);
-        b = (ubyte)(((float)(pixel & 0x001F)) * 8.2258f);
-        pixel = 0xFF000000 + (r << 16) + (g << 8) + b;
-        break;
-       
+#endif
+
+        for( ; i < count; i++, dst += 4 ) {
+            memcpy( dst, &word, 4 );
+        }
+        return;
+
     }
-    
-    // convert the 32-bit pixel from BGR to RGB.
-    pixel = (pixel & 0xFF00FF00) + ((pixel & 0xFF) << 16) + ((pixel & 0xFF0000) >> 16);
 
-    r = pixel & 0x000000FF;
-    g = (pixel & 0x0000FF00) >> 8;
-    b = (pixel & 0x00FF0000) >> 16;
-    a = (pixel & 0xFF000000) >> 24;
-    
-    // not premultiplied alpha -- multiply.
-    r = (ubyte)(((float)r / 255.0f) * ((float)a / 255.0f) * 255.0f);
-    g = (ubyte)(((float)g / 255.0f) * ((float)a / 255.0f) * 255.0f);
-    b = (ubyte)(((float)b / 255.0f) * ((float)a / 255.0f) * 255.0f);
+    for( ; i < count; i++, dst += format ) {
+        memcpy( dst, pixel, format );
+    }
 
-    pixel = r + (g << 8) + (b << 16) + (a << 24);
+}
 
-    /* now convert from 32-bit to whatever they want. */
-    
-    switch( format_out ) {
-        
-    case TGA_TRUECOLOR_32:
-        // 32 to 32 -- nop.
-        break;
-        
-    case TGA_TRUECOLOR_24:
-        // 32 to 24 -- discard alpha.
-        pixel &= 0x00FFFFFF;
-        break;
-        
+
+
+
+static void tga_load_rle_truecolor( const ubyte * src, size_t len, ubyte * dat, uint32 w, uint32 h, 
+                                    ubyte bytes_per_pix, int has_alpha, ubyte img_desc, uint32 format ) {
+
+    // span decoder for run-length encoded 24/32-bit images with a left-hand
+    // origin.  a run's colour is converted once and stored across the run,
+    // raw packets are converted a scanline piece at a time.  packets may
+    // cross scanlines, so both kinds are split at row ends.
+
+    uint32 num_pixels = w * h;
+    uint32 i = 0;
+    size_t pos = 0;
+    uint32 count, span, have, row, y;
+    ubyte  packet_header;
+    ubyte  color[4];
+    ubyte  missing[4];
+    ubyte * dst;
+    uint32 tmp_col;
+
+    // what a pixel past the end of the file decodes to.
+    tmp_col = has_alpha ? 0 : tga_convert_color( 0, 24, 0, format );
+    missing[0] = (ubyte)(tmp_col & 0xFF);
+    missing[1] = (ubyte)((tmp_col >> 8) & 0xFF);
+    missing[2] = (ubyte)((tmp_col >> 16) & 0xFF);
+    missing[3] = (ubyte)((tmp_col >> 24) & 0xFF);
+
+    if( has_alpha ) {
+        tga_build_tables();
     }
 
-    return( pixel );
+    while( i < num_pixels ) {
+
+        if( pos < len ) {
+            packet_header = src[pos++];
+        } else {
+            // well, just let them fill the rest with null pixels then...
+            packet_header = 1;
+        }
+
+        count = (packet_header & 0x7F) + 1;
+        if( count > num_pixels - i ) {
+            count = num_pixels - i;
+        }
+
+        if( packet_header & 0x80 ) {
+
+            /* run length packet */
+            if( pos + bytes_per_pix <= len ) {
+                tga_convert_row( src + pos, color, 1, bytes_per_pix, has_alpha, format );
+                pos += bytes_per_pix;
+            } else {
+                memcpy( color, missing, 4 );
+                pos = len;
+            }
+
+            while( count ) {
+                row  = i / w;
+                y    = (((img_desc & 0x30) >> 4) == TGA_UPPER_LEFT) ? h - 1 - row : row;
+                span = w - i % w;
+                span = span < count ? span : count;
+                dst  = dat + ((size_t)y * w + i % w) * format;
+
+                tga_fill_span( dst, span, color, format );
+
+                i += span;
+                count -= span;
+            }
+
+        } else {
+
+            /* raw packet */
+            while( count ) {
+                row  = i / w;
+                y    = (((img_desc & 0x30) >> 4) == TGA_UPPER_LEFT) ? h - 1 - row : row;
+                span = w - i % w;
+                span = span < count ? span : count;
+                dst  = dat + ((size_t)y * w + i % w) * format;
+
+                have = (uint32)((len - pos) / bytes_per_pix < span ? (len - pos) / bytes_per_pix : span);
+
+                if( have ) {
+                    tga_convert_row( src + pos, dst, have, bytes_per_pix, has_alpha, format );
+                    pos += have * bytes_per_pix;
+                }
+                if( have < span ) {
+                    tga_fill_span( dst + have * format, span - have, missing, format );
+                    pos = len;
+                }
+
+                i += span;
+                count -= span;
+            }
+
+        }
+
+    }
+
+}
+
+
+
+
+static void tga_add_row( uint32 * sums, const ubyte * src, size_t count ) {
+
+    size_t i = 0;
+
+#ifdef TGA_HAVE_SSE2
+    {
+        // widen 16 bytes to four vectors of 32-bit lanes and add them in.
+        const __m128i zero = _mm_setzero_si128();
+        __m128i v, lo, hi;
+
+        for( ; i + 16 <= count; i += 16 ) {
+            v  = _mm_loadu_si128( (const __m128i *)(src + i) );
+            lo = _mm_unpacklo_epi8( v, zero );
+            hi = _mm_unpackhi_epi8( v, zero );
+            _mm_storeu_si128( (__m128i *)(sums + i), 
+                _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(sums + i) ), _mm_unpacklo_epi16( lo, zero ) ) );
+            _mm_storeu_si128( (__m128i *)(sums + i + 4), 
+                _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(sums + i + 4) ), _mm_unpackhi_epi16( lo, zero ) ) );
+            _mm_storeu_si128( (__m128i *)(sums + i + 8), 
+                _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(sums + i + 8) ), _mm_unpacklo_epi16( hi, zero ) ) );
+            _mm_storeu_si128( (__m128i *)(sums + i + 12), 
+                _mm_add_epi32( _mm_loadu_si128( (const __m128i *)(sums + i + 12) ), _mm_unpackhi_epi16( hi, zero ) ) );
+        }
+    }
+#endif
+
+    for( ; i < count; i++ ) {
+        sums[i] += src[i];
+    }
+
+}
+
+
+
+
+static int tga_image_bytes( uint32 width, uint32 height, uint32 format, size_t * bytes ) {
+
+    // bytes in a width x height image, or 0 if that does not fit in a
+    // size_t.  a 65535 x 65535 image is 16GB, more than 32-bit builds hold.
+
+    size_t pixels = (size_t)width * height;
+
+    if( height != 0 && pixels / height != width ) {
+        return( 0 );
+    }
+    if( format != 0 && pixels > (size_t)-1 / format ) {
+        return( 0 );
+    }
+
+    *bytes = pixels * format;
+    return( 1 );
+
+}
+
+
+
+
+static void tga_shrink_sums( uint32 * sums, uint32 width, uint32 count, uint32 factor, uint32 format, 
+                             ubyte * dst ) {
+
+    // sums holds each column of a block row added up over count rows;
+    // average them in blocks of factor columns into one row of dst and
+    // clear the sums for the next block row.
+
+    uint32 x, i, c, cols, n;
+    unsigned long long sum[4];          // 255 * factor * factor passes 32 bits
+    uint32 * src;
+
+    for( x = 0; x < width; x += factor, dst += format ) {
+
+        cols = width - x < factor ? width - x : factor;
+        n = cols * count;
+
+        sum[0] = sum[1] = sum[2] = sum[3] = 0;
+        src = sums + (size_t)x * format;
+        for( i = 0; i < cols; i++, src += format ) {
+            for( c = 0; c < format; c++ ) {
+                sum[c] += src[c];
+                src[c] = 0;
+            }
+        }
+
+        for( c = 0; c < format; c++ ) {
+            dst[c] = (ubyte)((sum[c] + n / 2) / n);
+        }
+
+    }
+
+}
+
+
+
+
+static void tga_parse_header( const ubyte * hdr, tga_info * info ) {
+
+    ubyte image_type = hdr[HDR_IMAGE_TYPE];
+    ubyte origin = (hdr[HDR_IMG_SPEC_IMG_DESC] & 0x30) >> 4;
+
+    info->width      = (uint16)ttohs( *(uint16 *)(&hdr[HDR_IMG_SPEC_WIDTH]) );
+    info->height     = (uint16)ttohs( *(uint16 *)(&hdr[HDR_IMG_SPEC_HEIGHT]) );
+    info->depth      = hdr[HDR_IMG_SPEC_PIX_DEPTH];
+    info->image_type = image_type;
+    info->compressed = image_type == TGA_IMG_RLE_PALETTED || 
+                       image_type == TGA_IMG_RLE_TRUECOLOR || 
+                       image_type == TGA_IMG_RLE_GRAYSCALE;
+    info->paletted   = hdr[HDR_CMAP_TYPE] != 0;
+    info->alpha_bits = hdr[HDR_IMG_SPEC_IMG_DESC] & 0x0F;
+    info->row_order  = (origin == TGA_UPPER_LEFT || origin == TGA_UPPER_RIGHT) ? TGA_TOP_DOWN : TGA_BOTTOM_UP;
+
+}
+
+
+
+
+static size_t tga_reader_fill( tga_reader * reader, size_t want ) {
+
+    // make at least want bytes available at reader->pos, if the file has
+    // them; returns the number available.
+
+    size_t got;
+
+    if( reader->len - reader->pos >= want || reader->eof ) {
+        return( reader->len - reader->pos );
+    }
+
+    memmove( reader->buf, reader->buf + reader->pos, reader->len - reader->pos );
+    reader->len -= reader->pos;
+    reader->pos = 0;
+
+    if( want > reader->cap ) {
+        want = reader->cap;
+    }
+
+    while( reader->len < want && !reader->eof ) {
+        got = fread( reader->buf + reader->len, 1, reader->cap - reader->len, reader->file );
+        reader->len += got;
+        if( got == 0 ) {
+            reader->eof = 1;
+        }
+    }
+
+    return( reader->len );
+
+}
+
+
+
+
+static void tga_reader_raw( tga_reader * reader, ubyte * dst, uint32 count ) {
+
+    // convert count stored pixels, a buffer at a time, or just step over
+    // them if dst is NULL.  once the file runs short every remaining pixel
+    // is missing, as in the loaders.
+
+    uint32 have;
+    size_t avail;
+
+    while( count ) {
+
+        avail = tga_reader_fill( reader, (size_t)count * reader->bytes_per_pix ) / reader->bytes_per_pix;
+        have = avail < count ? (uint32)avail : count;
+
+        if( have == 0 ) {
+            if( dst != NULL ) {
+                tga_fill_span( dst, count, reader->missing, reader->format );
+            }
+            reader->pos = reader->len;
+            return;
+        }
+
+        if( dst != NULL ) {
+            tga_convert_row( reader->buf + reader->pos, dst, have, reader->bytes_per_pix, 
+                             reader->has_alpha, reader->format );
+            dst += have * reader->format;
+        }
+        reader->pos += (size_t)have * reader->bytes_per_pix;
+        count -= have;
+
+    }
+
+}
+
+
+
+
+static void tga_reader_pixels( tga_reader * reader, ubyte * dst, uint32 count ) {
+
+    // decode the next count stored pixels, or skip them if dst is NULL.
+    // RLE packets don't stop at scanlines, so what is left of one is kept
+    // for the next call.  a run's colour is only converted once some of
+    // it is actually wanted.
+
+    uint32 span;
+    ubyte packet_header;
+
+    if( !reader->rle ) {
+        tga_reader_raw( reader, dst, count );
+        return;
+    }
+
+    while( count ) {
+
+        if( reader->packet_left == 0 ) {
+
+            if( tga_reader_fill( reader, 1 ) ) {
+                packet_header = reader->buf[reader->pos++];
+            } else {
+                packet_header = 1;
+            }
+
+            reader->packet_left = (packet_header & 0x7F) + 1;
+            reader->packet_run = (packet_header & 0x80) != 0;
+
+            if( reader->packet_run ) {
+                if( tga_reader_fill( reader, reader->bytes_per_pix ) >= reader->bytes_per_pix ) {
+                    memcpy( reader->run_pixel, reader->buf + reader->pos, reader->bytes_per_pix );
+                    reader->run_state = 1;
+                    reader->pos += reader->bytes_per_pix;
+                } else {
+                    memcpy( reader->color, reader->missing, 4 );
+                    reader->run_state = 2;
+                    reader->pos = reader->len;
+                }
+            }
+
+        }
+
+        span = count < reader->packet_left ? count : reader->packet_left;
+
+        if( reader->packet_run ) {
+            if( dst != NULL ) {
+                if( reader->run_state == 1 ) {
+                    tga_convert_row( reader->run_pixel, reader->color, 1, 
+                                     reader->bytes_per_pix, reader->has_alpha, reader->format );
+                    reader->run_state = 2;
+                }
+                tga_fill_span( dst, span, reader->color, reader->format );
+            }
+        } else {
+            tga_reader_raw( reader, dst, span );
+        }
+
+        if( dst != NULL ) {
+            dst += span * reader->format;
+        }
+        count -= span;
+        reader->packet_left -= span;
+
+    }
+
+}
+
+
+
+
+static void tga_reader_row( tga_reader * reader, ubyte * dst, uint32 x, uint32 count ) {
+
+    // decode columns [x, x + count) of the next stored scanline into dst
+    // and step over the rest of it.  uncompressed rows seek past what
+    // isn't wanted; RLE rows have to walk their packets.
+
+    uint32 first;
+    ubyte tmp[4];
+    ubyte * a;
+    ubyte * b;
+
+    // right-to-left rows hold the wanted columns mirrored.
+    first = reader->mirrored ? reader->width - x - count : x;
+
+    if( reader->rle ) {
+        tga_reader_pixels( reader, NULL, first );
+        tga_reader_pixels( reader, dst, count );
+        tga_reader_pixels( reader, NULL, reader->width - first - count );
+    } else {
+        if( first != 0 || reader->off_row ) {
+            tga_reader_seek( reader, reader->row, first );
+        }
+        tga_reader_pixels( reader, dst, count );
+        reader->off_row = first + count != reader->width;
+    }
+
+    reader->row++;
+
+    // ...and are turned around once they're decoded.
+    if( reader->mirrored && count ) {
+        a = dst;
+        b = dst + (count - 1) * reader->format;
+        for( ; a < b; a += reader->format, b -= reader->format ) {
+            memcpy( tmp, a, reader->format );
+            memcpy( a, b, reader->format );
+            memcpy( b, tmp, reader->format );
+        }
+    }
+
+}
+
+
+
+
+static void tga_reader_skip_rows( tga_reader * reader, uint32 rows ) {
+
+    // step over whole scanlines without converting anything.  the seek
+    // for uncompressed rows waits for the next row that's wanted.
+
+    if( reader->rle ) {
+        for( ; rows; rows--, reader->row++ ) {
+            tga_reader_pixels( reader, NULL, reader->width );
+        }
+    } else {
+        reader->row += rows;
+        reader->off_row = 1;
+    }
+
+}
+
+
+
+
+static void tga_reader_seek( tga_reader * reader, uint32 row, uint32 x ) {
+
+    // uncompressed rows are a fixed size, so go straight to a pixel.  if
+    // the seek fails the rest of the file reads as missing.
+
+    reader->pos = 0;
+    reader->len = 0;
+    reader->eof = 0;
+
+    if( tga_fseek( reader->file, reader->data_start + 
+                                 ((tga_off)row * reader->width + x) * reader->bytes_per_pix, SEEK_SET ) != 0 ) {
+        reader->failed = 1;
+        reader->eof = 1;
+    }
 
 }
 
@@ -1245,17 +2941,3 @@ static int32 ttohl( int32 val ) {
 #endif 
 
 }
-
-
-static int32 htotl( int32 val ) {
-
-#ifdef WORDS_BIGENDIAN
-    return( ((val & 0x000000FF) << 24) +
-            ((val & 0x0000FF00) << 8)  +
-            ((val & 0x00FF0000) >> 8)  +
-            ((val & 0xFF000000) >> 24) );
-#else
-    return( val );
-#endif 
-
-}
@@ -39,6 +39,9 @@
  ** DEALINGS IN THE SOFTWARE.
  **/
 
+#include <stddef.h>
+
+
 /* uncomment this line if you're compiling on a big-endian machine */
 /* #define WORDS_BIGENDIAN */
 
@@ -101,15 +104,31 @@
 /*
    Image data will start in the low-left corner
    of the image.
+
+   The _ex functions take a row order instead, so callers that keep
+   their rows top to bottom can skip flipping the image themselves.
 */
 
+#define TGA_BOTTOM_UP         (0)
+#define TGA_TOP_DOWN          (1)
+
+
+/*
+   Allocator for tga_load_ex.  It is called once with the number of
+   bytes the decoded image needs; returning NULL fails the load.
+*/
+
+typedef void * (*tga_alloc_func)( void * user, size_t bytes );
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 
-/* Error handling routines */
+/* Error handling routines  --  the last error is kept per thread.  The _r variants
+   below store the error code of a failed call in *error instead, so a caller never
+   shares error state with anyone */
 int             tga_get_last_error();
 const char *    tga_error_string( int error_code );
 
@@ -117,11 +136,105 @@ const char *    tga_error_string( int error_code );
 /* Creating/Loading images  --  a return of NULL indicates a fatal error */
 void * tga_create( int width, int height, unsigned int format );
 void * tga_load( const char * file, int * width, int * height, unsigned int format );
+void * tga_load_ex( const char * file, int * width, int * height, unsigned int format,
+                    int row_order, tga_alloc_func alloc, void * user );
+void * tga_load_r( const char * file, int * width, int * height, unsigned int format,
+                   int row_order, tga_alloc_func alloc, void * user, int * error );
+
+
+/* Decoding/encoding images held in memory  --  tga_encode_memory returns a malloc'ed
+   buffer holding a whole targa file (raw, or run-length encoded if compressed is
+   non-zero) and stores its length in size; release it with free() */
+void * tga_decode_memory( const void * buf, size_t len, int * width, int * height, unsigned int format );
+void * tga_decode_memory_ex( const void * buf, size_t len, int * width, int * height, unsigned int format,
+                             int row_order, tga_alloc_func alloc, void * user );
+void * tga_decode_memory_r( const void * buf, size_t len, int * width, int * height, unsigned int format,
+                            int row_order, tga_alloc_func alloc, void * user, int * error );
+void * tga_encode_memory( int width, int height, const unsigned char * dat, unsigned int format,
+                          int row_order, int compressed, size_t * size );
+void * tga_encode_memory_r( int width, int height, const unsigned char * dat, unsigned int format,
+                            int row_order, int compressed, size_t * size, int * error );
 
 
 /* Writing images to file  --  a return of 1 indicates success, 0 indicates error*/
 int tga_write_raw( const char * file, int width, int height, unsigned char * dat, unsigned int format );
+int tga_write_raw_ex( const char * file, int width, int height, const unsigned char * dat, 
+                      unsigned int format, int row_order );
+int tga_write_raw_r( const char * file, int width, int height, const unsigned char * dat, 
+                     unsigned int format, int row_order, int * error );
 int tga_write_rle( const char * file, int width, int height, unsigned char * dat, unsigned int format );
+int tga_write_rle_ex( const char * file, int width, int height, const unsigned char * dat, 
+                      unsigned int format, int row_order );
+int tga_write_rle_r( const char * file, int width, int height, const unsigned char * dat, 
+                     unsigned int format, int row_order, int * error );
+
+
+/* What the header says about a file, from tga_probe  --  depth is bits per stored
+   pixel (the index size for paletted images), row_order says whether the rows are
+   stored top or bottom first */
+typedef struct {
+    int width;
+    int height;
+    int depth;
+    int image_type;
+    int compressed;
+    int paletted;
+    int alpha_bits;
+    int row_order;
+} tga_info;
+
+int tga_probe( const char * file, tga_info * info );
+
+
+/* Loading part of an image  --  (x, y) is the top left corner of the rectangle counting
+   rows from the top of the image; only the rectangle is converted, and it must lie
+   wholly inside the image */
+void * tga_load_region( const char * file, int x, int y, int width, int height, unsigned int format,
+                        int row_order, tga_alloc_func alloc, void * user );
+void * tga_load_region_r( const char * file, int x, int y, int width, int height, unsigned int format,
+                          int row_order, tga_alloc_func alloc, void * user, int * error );
+
+
+/* Loading at reduced size  --  every factor x factor block of pixels is averaged into
+   one while the file is decoded, so the full size image is never held in memory.
+   width and height return the reduced size, rounded up */
+void * tga_load_scaled( const char * file, int factor, int * width, int * height, unsigned int format,
+                        int row_order, tga_alloc_func alloc, void * user );
+void * tga_load_scaled_r( const char * file, int factor, int * width, int * height, unsigned int format,
+                          int row_order, tga_alloc_func alloc, void * user, int * error );
+
+
+/* Streaming a band of scanlines at a time  --  the reader hands rows back in the order
+   they are stored (row_order says which) and handles uncompressed and RLE truecolor
+   files; the writer takes rows in the row order it was opened with.  tga_read_band
+   returns the number of rows decoded, 0 once the image is done */
+typedef struct tga_reader tga_reader;
+typedef struct tga_writer tga_writer;
+
+tga_reader * tga_reader_open( const char * file, int * width, int * height, unsigned int format,
+                              int * row_order );
+int tga_read_band( tga_reader * reader, unsigned char * dat, int rows );
+void tga_reader_close( tga_reader * reader );
+
+tga_writer * tga_writer_open( const char * file, int width, int height, unsigned int format,
+                              int row_order, int compressed );
+int tga_write_band( tga_writer * writer, const unsigned char * dat, int rows );
+int tga_writer_close( tga_writer * writer );
+
+
+/* Run-length encoding in pieces  --  file rows count from the bottom of the image and
+   RLE packets never cross a row, so bands can be encoded independently and the
+   blocks written in order give the same file as tga_write_rle_ex */
+size_t tga_rle_bound( int width, int rows, unsigned int format );
+size_t tga_encode_rle_rows( const unsigned char * dat, int width, int height, unsigned int format, 
+                            int row_order, int first_row, int rows, unsigned char * out );
+size_t tga_encode_rle_rows_r( const unsigned char * dat, int width, int height, unsigned int format, 
+                              int row_order, int first_row, int rows, unsigned char * out, int * error );
+int tga_write_rle_blocks( const char * file, int width, int height, unsigned int format, 
+                          const unsigned char * const * blocks, const size_t * lengths, int count );
+int tga_write_rle_blocks_r( const char * file, int width, int height, unsigned int format, 
+                            const unsigned char * const * blocks, const size_t * lengths, int count, 
+                            int * error );
 
 
 
@@ -0,0 +1,248 @@
+/*
+** big_tga.c -- makes and checks a targa at the 65535x65535 size limit.
+**
+**   big_tga make file     writes a 24 bit RLE image of 4096x4096 blocks,
+**                         block (bx, by) being (17 bx, 17 by, 255 or 0 as
+**                         bx + by is odd or even)
+**   big_tga check file    reads the image back a band at a time and checks
+**                         that every pixel is the 5x5 box filter of it,
+**                         reflected at the edges and rounded to nearest
+**
+** test/limit.txt loads the image with a 64M memory budget, so it stays out
+** of core, box filters it and saves it; "make limit-test" runs the three
+** steps.  Neither the image nor the filtered one is ever held in memory
+** whole.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../libtarga.h"
+
+
+#define BIG_SIZE       (65535)
+#define BIG_BLOCK      (4096)
+#define BIG_RADIUS     (2)
+#define BIG_BAND       (64)
+
+
+
+
+static void block_color( int x, int y, unsigned char * color ) {
+
+    int bx = x / BIG_BLOCK;
+    int by = y / BIG_BLOCK;
+
+    color[0] = (unsigned char)(bx * 17);
+    color[1] = (unsigned char)(by * 17);
+    color[2] = (unsigned char)((bx + by) % 2 ? 255 : 0);
+
+}
+
+
+
+
+static int reflect( int i ) {
+
+    // a tap off the image is reflected through the end pixel, as the
+    // filters reflect
+    if( i < 0 ) {
+        return( -i );
+    }
+    if( i >= BIG_SIZE ) {
+        return( 2 * (BIG_SIZE - 1) - i );
+    }
+    return( i );
+
+}
+
+
+
+
+static int make_image( const char * filename ) {
+
+    tga_writer * writer;
+    unsigned char * row;
+    int x, y;
+
+    writer = tga_writer_open( filename, BIG_SIZE, BIG_SIZE, TGA_TRUECOLOR_24, TGA_TOP_DOWN, 1 );
+    row = (unsigned char *)malloc( (size_t)BIG_SIZE * 3 );
+    if( writer == NULL || row == NULL ) {
+        printf( "big_tga: can't write %s: %s\n", filename, tga_error_string( tga_get_last_error() ) );
+        if( writer != NULL ) {
+            tga_writer_close( writer );
+        }
+        free( row );
+        return( 0 );
+    }
+
+    for( y = 0; y < BIG_SIZE; y++ ) {
+
+        // rows only change from one block to the next
+        if( y % BIG_BLOCK == 0 ) {
+            for( x = 0; x < BIG_SIZE; x++ ) {
+                block_color( x, y, row + (size_t)x * 3 );
+            }
+        }
+
+        if( !tga_write_band( writer, row, 1 ) ) {
+            printf( "big_tga: can't write %s: %s\n", filename, tga_error_string( tga_get_last_error() ) );
+            tga_writer_close( writer );
+            free( row );
+            return( 0 );
+        }
+
+    }
+
+    free( row );
+    return( tga_writer_close( writer ) );
+
+}
+
+
+
+
+static void expected_row( int y, unsigned char * row, unsigned int * columns ) {
+
+    // add up the 5 rows under the box for every column, then the 5 columns
+    unsigned char color[3];
+    int x, i, c, dy;
+    unsigned int sum;
+
+    memset( columns, 0, (size_t)BIG_SIZE * 3 * sizeof( unsigned int ) );
+    for( dy = -BIG_RADIUS; dy <= BIG_RADIUS; dy++ ) {
+        for( x = 0; x < BIG_SIZE; x++ ) {
+            block_color( x, reflect( y + dy ), color );
+            for( c = 0; c < 3; c++ ) {
+                columns[(size_t)x * 3 + c] += color[c];
+            }
+        }
+    }
+
+    for( x = 0; x < BIG_SIZE; x++ ) {
+        for( c = 0; c < 3; c++ ) {
+            sum = 0;
+            for( i = -BIG_RADIUS; i <= BIG_RADIUS; i++ ) {
+                sum += columns[(size_t)reflect( x + i ) * 3 + c];
+            }
+            row[(size_t)x * 3 + c] = (unsigned char)((sum + 12) / 25);
+        }
+    }
+
+}
+
+
+
+
+static int check_image( const char * filename ) {
+
+    tga_reader * reader;
+    unsigned char * band;
+    unsigned char * expect;
+    unsigned int * columns;
+    int width, height, row_order;
+    int rows, i, y, x, c;
+    int stored = 0;
+    int key, dy;
+    int blocks = -1;            // the rows of blocks under the box of the last row expected
+
+    reader = tga_reader_open( filename, &width, &height, TGA_TRUECOLOR_24, &row_order );
+    if( reader == NULL ) {
+        printf( "big_tga: can't read %s: %s\n", filename, tga_error_string( tga_get_last_error() ) );
+        return( 0 );
+    }
+    if( width != BIG_SIZE || height != BIG_SIZE ) {
+        printf( "big_tga: %s is %dx%d, not %dx%d\n", filename, width, height, BIG_SIZE, BIG_SIZE );
+        tga_reader_close( reader );
+        return( 0 );
+    }
+
+    band = (unsigned char *)malloc( (size_t)BIG_BAND * BIG_SIZE * 3 );
+    expect = (unsigned char *)malloc( (size_t)BIG_SIZE * 3 );
+    columns = (unsigned int *)malloc( (size_t)BIG_SIZE * 3 * sizeof( unsigned int ) );
+    if( band == NULL || expect == NULL || columns == NULL ) {
+        printf( "big_tga: out of memory\n" );
+        free( band );
+        free( expect );
+        free( columns );
+        tga_reader_close( reader );
+        return( 0 );
+    }
+
+    while( (rows = tga_read_band( reader, band, BIG_BAND )) > 0 ) {
+
+        for( i = 0; i < rows; i++, stored++ ) {
+
+            y = row_order == TGA_TOP_DOWN ? stored : BIG_SIZE - 1 - stored;
+
+            // the expected row only changes when the blocks under the box do
+            key = 0;
+            for( dy = -BIG_RADIUS; dy <= BIG_RADIUS; dy++ ) {
+                key = key * 16 + reflect( y + dy ) / BIG_BLOCK;
+            }
+            if( key != blocks ) {
+                expected_row( y, expect, columns );
+                blocks = key;
+            }
+
+            if( memcmp( band + (size_t)i * BIG_SIZE * 3, expect, (size_t)BIG_SIZE * 3 ) ) {
+                for( x = 0; x < BIG_SIZE; x++ ) {
+                    for( c = 0; c < 3; c++ ) {
+                        if( band[((size_t)i * BIG_SIZE + x) * 3 + c] != expect[(size_t)x * 3 + c] ) {
+                            break;
+                        }
+                    }
+                    if( c < 3 ) {
+                        break;
+                    }
+                }
+                printf( "big_tga: %s pixel (%d, %d) is (%d, %d, %d), not (%d, %d, %d)\n", filename, x, y,
+                        band[((size_t)i * BIG_SIZE + x) * 3], band[((size_t)i * BIG_SIZE + x) * 3 + 1],
+                        band[((size_t)i * BIG_SIZE + x) * 3 + 2],
+                        expect[(size_t)x * 3], expect[(size_t)x * 3 + 1], expect[(size_t)x * 3 + 2] );
+                stored = -1;
+                break;
+            }
+
+        }
+
+        if( stored < 0 ) {
+            break;
+        }
+
+    }
+
+    free( band );
+    free( expect );
+    free( columns );
+    tga_reader_close( reader );
+
+    if( stored != BIG_SIZE ) {
+        if( stored >= 0 ) {
+            printf( "big_tga: %s ends after %d rows\n", filename, stored );
+        }
+        return( 0 );
+    }
+
+    printf( "big_tga: %s is correct\n", filename );
+    return( 1 );
+
+}
+
+
+
+
+int main( int argc, char * argv[] ) {
+
+    if( argc == 3 && !strcmp( argv[1], "make" ) ) {
+        return( make_image( argv[2] ) ? 0 : 1 );
+    }
+    if( argc == 3 && !strcmp( argv[1], "check" ) ) {
+        return( check_image( argv[2] ) ? 0 : 1 );
+    }
+
+    printf( "Usage: big_tga make|check file\n" );
+    return( 2 );
+
+}